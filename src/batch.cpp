@@ -0,0 +1,103 @@
+#include "batch.hpp"
+#include "mempool.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <oneapi/tbb/task_arena.h>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace filt {
+
+batch_layout plan_batch(
+  ptrdiff_t frame_pixels,
+  int decoded_channels,
+  int queue_length,
+  const batch_options& options
+) {
+  const int threads = options.threads > 0 ? options.threads : int(get_affinity().size());
+  const ptrdiff_t pixels_per_thread = std::max<ptrdiff_t>(1, options.pixels_per_thread);
+  const ptrdiff_t wanted = (frame_pixels + pixels_per_thread - 1) / pixels_per_thread;
+  const int threads_per_frame = int(std::clamp<ptrdiff_t>(wanted, 1, threads));
+
+  const ptrdiff_t decoded_bytes = frame_pixels * decoded_channels * ptrdiff_t(sizeof(float));
+  const ptrdiff_t frame_bytes = decoded_bytes + memory_pool::gbuffer_size_bytes(frame_pixels);
+  const ptrdiff_t frames_in_memory = options.memory_budget / frame_bytes;
+  const int concurrent_frames = int(std::max<ptrdiff_t>(1, std::min<ptrdiff_t>({
+    threads / threads_per_frame,
+    queue_length,
+    frames_in_memory,
+  })));
+
+  return batch_layout{
+    .concurrent_frames = concurrent_frames,
+    .threads_per_frame = std::max(1, threads / concurrent_frames),
+  };
+}
+
+batch_layout filter_batch(
+  std::span<const char* const> exr_filenames,
+  const frame_sink& sink,
+  const batch_options& options
+) {
+  const int frames = std::ssize(exr_filenames);
+  if (frames == 0) {
+    return {};
+  }
+  const rect first = exr_data_window(exr_filenames[0]);
+  // no rows, only the channels a decode keeps
+  const int channels = std::ssize(image(exr_filenames[0], is_gbuffer_channel, 0, 0).meta.channels);
+  const batch_layout layout = plan_batch(
+    ptrdiff_t(first.width()) * first.height(), channels, frames, options);
+
+  std::atomic<int> next_frame = 0;
+  std::mutex error_mutex;
+  std::exception_ptr error;
+
+  auto worker = [&] {
+    try {
+      tbb::task_arena arena(layout.threads_per_frame);
+      std::optional<memory_pool> pool;
+      for (int i; (i = next_frame++) < frames;) {
+        auto gbuf = image(exr_filenames[i], is_gbuffer_channel);
+        const ptrdiff_t pool_bytes = memory_pool::gbuffer_size_bytes(
+          tiled_pixel_count(gbuf.meta.width, gbuf.meta.height, options.tile_size));
+        if (!pool || std::ssize(pool->memory) < pool_bytes) {
+          pool.reset();
+          pool.emplace(pool_bytes);
+        }
+
+        const ptrdiff_t mark = pool->top;
+        auto streams = pool->upload_gbuffer(gbuf, 0, gbuf.meta.height, options.tile_size);
+        arena.execute([&] {
+          linear_filter(gbuf.meta, streams, options.params);
+        });
+        sink(i, gbuf, streams.dst);
+        pool->release_to(mark);
+      }
+    } catch (...) {
+      next_frame = frames;
+      std::lock_guard lock(error_mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < layout.concurrent_frames; ++i) {
+    workers.emplace_back(worker);
+  }
+  for (std::thread& thread: workers) {
+    thread.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return layout;
+}
+
+}  // namespace filt
\ No newline at end of file
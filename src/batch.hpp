@@ -0,0 +1,42 @@
+#pragma once
+#include "image.hpp"
+#include <functional>
+#include <span>
+
+namespace filt {
+
+struct batch_options {
+  // threads for the whole batch, 0 for every cpu the process may run on
+  int threads = 0;
+  // pixels a frame needs per thread before its own parallel loops scale
+  ptrdiff_t pixels_per_thread = 256 * 1024;
+  // memory of all frames in flight together: the decoded gbuffer and its pool streams
+  ptrdiff_t memory_budget = ptrdiff_t(4) << 30;
+  // layout of the normal and z streams, see tiled_pixel_index
+  int tile_size = 0;
+  filter_params params;
+};
+
+struct batch_layout {
+  int concurrent_frames = 1;
+  int threads_per_frame = 1;
+};
+
+// threads per frame from its pixel count, then as many frames side by side as threads and memory allow
+batch_layout plan_batch(
+  ptrdiff_t frame_pixels,
+  int decoded_channels,
+  int queue_length,
+  const batch_options& options);
+
+// a finished frame and its interleaved rgb; called concurrently, in no particular frame order
+using frame_sink = std::function<void(int index, const image& gbuffer, std::span<const float> filtered)>;
+
+// concurrent_frames workers, each with its own arena and pool, pulling frames off the queue; the
+// layout is planned from the first frame
+batch_layout filter_batch(
+  std::span<const char* const> exr_filenames,
+  const frame_sink& sink,
+  const batch_options& options = {});
+
+}  // namespace filt
\ No newline at end of file
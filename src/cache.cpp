@@ -0,0 +1,269 @@
+#include "cache.hpp"
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace filt {
+
+namespace {
+
+constexpr char cache_magic[8] = {'f', 'i', 'l', 't', 'g', 'b', 'u', 'f'};
+constexpr uint32_t cache_version = 1;
+constexpr ptrdiff_t page_size = 4096;
+
+struct source_identity {
+  uint64_t dev;
+  uint64_t ino;
+  int64_t size;
+  int64_t mtime_ns;
+
+  bool operator==(const source_identity&) const = default;
+};
+
+struct cache_channel {
+  char name[24];
+  int32_t elem_width_bytes;
+  int64_t base_offset_bytes;
+  int64_t stride_x_bytes;
+  int64_t stride_y_bytes;
+};
+
+struct cache_header {
+  char magic[8];
+  uint32_t version;
+  int32_t width;
+  int32_t height;
+  int32_t first_row;
+  source_identity source;
+  int64_t file_size;
+  uint32_t channel_count;
+  cache_channel channels[9];
+};
+static_assert(sizeof(cache_header) <= page_size);
+
+// the streams in file order, each a 3-channel interleaved block
+constexpr const char* stream_channels[3][3] = {
+  {"R", "G", "B"},
+  {"Albedo.R", "Albedo.G", "Albedo.B"},
+  {"Ns.X", "Ns.Y", "Ns.Z"},
+};
+
+std::optional<source_identity> identify(const char* path) {
+  struct stat st;
+  if (::stat(path, &st) == -1) {
+    return std::nullopt;
+  }
+  return source_identity{
+    .dev = st.st_dev,
+    .ino = st.st_ino,
+    .size = st.st_size,
+    .mtime_ns = int64_t(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec,
+  };
+}
+
+// every channel where write puts it and inside the file, so open can fall back to decoding a
+// cache that is truncated or corrupt instead of reading past the mapping
+bool layout_ok(const cache_header& header) {
+  if (header.width <= 0 || header.height <= 0 || header.first_row < 0 || header.channel_count != 9) {
+    return false;
+  }
+  const int64_t stream_bytes = 3 * int64_t(sizeof(float)) * header.width * header.height;
+  if (header.file_size < page_size + 3 * stream_bytes) {
+    return false;
+  }
+  for (int s = 0; s < 3; ++s) {
+    for (int c = 0; c < 3; ++c) {
+      const cache_channel& channel = header.channels[3 * s + c];
+      const int64_t stream_offset = channel.base_offset_bytes - c * int64_t(sizeof(float));
+      const bool ok = std::strncmp(channel.name, stream_channels[s][c], sizeof(channel.name)) == 0
+        && channel.elem_width_bytes == sizeof(float)
+        && channel.stride_x_bytes == 3 * sizeof(float)
+        && channel.stride_y_bytes == 3 * int64_t(sizeof(float)) * header.width
+        && stream_offset >= page_size
+        && stream_offset % page_size == 0
+        && stream_offset <= header.file_size - stream_bytes;
+      if (!ok) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void write_all(int fd, const void* data, ptrdiff_t size) {
+  auto bytes = static_cast<const std::byte*>(data);
+  while (size > 0) {
+    ssize_t written = ::write(fd, bytes, size);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw errno_error("write gbuffer cache");
+    }
+    bytes += written;
+    size -= written;
+  }
+}
+
+}  // namespace
+
+gbuffer_cache::gbuffer_cache(gbuffer_cache&& other):
+  meta(std::move(other.meta)),
+  mapping(std::exchange(other.mapping, {})),
+  color(other.color),
+  albedo(other.albedo),
+  normals(other.normals)
+{}
+
+gbuffer_cache& gbuffer_cache::operator=(gbuffer_cache&& other) {
+  // the old mapping goes away with `other`
+  std::swap(meta, other.meta);
+  std::swap(mapping, other.mapping);
+  std::swap(color, other.color);
+  std::swap(albedo, other.albedo);
+  std::swap(normals, other.normals);
+  return *this;
+}
+
+gbuffer_cache::~gbuffer_cache() {
+  if (!mapping.empty()) {
+    ::munmap(const_cast<std::byte*>(mapping.data()), mapping.size_bytes());
+  }
+}
+
+std::optional<gbuffer_cache> gbuffer_cache::open(const char* cache_path, const char* exr_filename) {
+  const auto source = identify(exr_filename);
+  if (!source) {
+    throw errno_error("stat source exr");
+  }
+
+  int fd = ::open(cache_path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return std::nullopt;
+  }
+
+  cache_header header;
+  struct stat st;
+  const bool header_ok = ::fstat(fd, &st) == 0
+    && ::pread(fd, &header, sizeof(header), 0) == sizeof(header)
+    && std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) == 0
+    && header.version == cache_version
+    && header.source == *source
+    && header.file_size == st.st_size
+    && layout_ok(header);
+  if (!header_ok) {
+    ::close(fd);
+    log_out("Gbuffer cache {} is stale", cache_path);
+    return std::nullopt;
+  }
+
+  void* mapped = ::mmap(nullptr, header.file_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    throw errno_error("mmap gbuffer cache");
+  }
+
+  gbuffer_cache result;
+  result.mapping = std::span(static_cast<const std::byte*>(mapped), header.file_size);
+  result.meta.width = header.width;
+  result.meta.height = header.height;
+  result.meta.first_row = header.first_row;
+  for (const cache_channel& channel: std::span(header.channels, header.channel_count)) {
+    result.meta.channels.push_back(linear_channel{
+      .name = std::string(channel.name, strnlen(channel.name, sizeof(channel.name))),
+      .elem_width_bytes = channel.elem_width_bytes,
+      .base_offset_bytes = channel.base_offset_bytes,
+      .stride_x_bytes = channel.stride_x_bytes,
+      .stride_y_bytes = channel.stride_y_bytes,
+    });
+  }
+
+  const ptrdiff_t stream_elems = 3 * result.meta.total_pixels();
+  auto stream = [&](const char* first_channel) {
+    const ptrdiff_t offset = result.meta.find_channel(first_channel).base_offset_bytes;
+    assert_release(offset % page_size == 0);
+    assert_release(offset + stream_elems * ptrdiff_t(sizeof(float)) <= header.file_size);
+    return std::span(reinterpret_cast<const float*>(result.mapping.data() + offset), stream_elems);
+  };
+  result.color = stream("R");
+  result.albedo = stream("Albedo.R");
+  result.normals = stream("Ns.X");
+
+  log_out("Mapped gbuffer cache {}", cache_path);
+  return result;
+}
+
+void gbuffer_cache::write(
+  const char* cache_path,
+  const char* exr_filename,
+  const image_meta& meta,
+  const filter_streams& streams
+) {
+  const auto source = identify(exr_filename);
+  if (!source) {
+    throw errno_error("stat source exr");
+  }
+
+  const std::span<const float> stream_data[3] = {streams.color, streams.albedo, streams.normals};
+  const ptrdiff_t stream_bytes = 3 * meta.total_pixels() * ptrdiff_t(sizeof(float));
+  const ptrdiff_t stream_pages = (stream_bytes + page_size - 1) / page_size;
+
+  // zeroed padding included, which value-initialization does not promise
+  cache_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.version = cache_version;
+  header.width = meta.width;
+  header.height = meta.height;
+  header.first_row = meta.first_row;
+  header.source = *source;
+  header.file_size = page_size * (1 + 3 * stream_pages);
+  header.channel_count = 9;
+  for (int s = 0; s < 3; ++s) {
+    assert_release(std::ssize(stream_data[s]) * ptrdiff_t(sizeof(float)) == stream_bytes);
+    for (int c = 0; c < 3; ++c) {
+      cache_channel& channel = header.channels[3 * s + c];
+      std::strncpy(channel.name, stream_channels[s][c], sizeof(channel.name) - 1);
+      channel.elem_width_bytes = sizeof(float);
+      channel.base_offset_bytes = page_size * (1 + s * stream_pages) + c * sizeof(float);
+      channel.stride_x_bytes = 3 * sizeof(float);
+      channel.stride_y_bytes = 3 * sizeof(float) * ptrdiff_t(meta.width);
+    }
+  }
+
+  const std::string temp_path = fmt::format("{}.{}.tmp", cache_path, ::getpid());
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    throw errno_error("create gbuffer cache");
+  }
+  try {
+    static const std::byte zeros[page_size] = {};
+    write_all(fd, &header, sizeof(header));
+    write_all(fd, zeros, page_size - sizeof(header));
+    for (auto& data: stream_data) {
+      write_all(fd, data.data(), stream_bytes);
+      write_all(fd, zeros, stream_pages * page_size - stream_bytes);
+    }
+    if (::close(std::exchange(fd, -1)) == -1) {
+      throw errno_error("close gbuffer cache");
+    }
+    if (::rename(temp_path.c_str(), cache_path) == -1) {
+      throw errno_error("rename gbuffer cache");
+    }
+  } catch (...) {
+    if (fd != -1) {
+      ::close(fd);
+    }
+    ::unlink(temp_path.c_str());
+    throw;
+  }
+
+  log_out("Wrote gbuffer cache {}", cache_path);
+}
+
+}  // namespace filt
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+#include "image.hpp"
+#include "util.hpp"
+#include <optional>
+#include <span>
+
+namespace filt {
+
+// read-only mapping of the page-aligned linear_filter streams of a gbuffer, behind an image_meta header;
+// channel base offsets in `meta` are byte offsets into the file
+struct gbuffer_cache: noncopyable {
+  image_meta meta;
+  std::span<const std::byte> mapping;
+  std::span<const float> color;
+  std::span<const float> albedo;
+  std::span<const float> normals;
+
+  gbuffer_cache(gbuffer_cache&& other);
+  gbuffer_cache& operator=(gbuffer_cache&& other);
+  ~gbuffer_cache();
+
+  // nullopt if the cache is missing, unreadable or was made from a different version of the
+  // source exr (device, inode, size and mtime are recorded in the header)
+  static std::optional<gbuffer_cache> open(const char* cache_path, const char* exr_filename);
+
+  // writes the input streams of `streams` atomically (temporary file + rename)
+  static void write(
+    const char* cache_path,
+    const char* exr_filename,
+    const image_meta& meta,
+    const filter_streams& streams);
+
+private:
+  gbuffer_cache() = default;
+};
+
+}  // namespace filt
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "filt.h"
+#include "image.hpp"
+#include "mempool.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <string>
+#include <utility>
+
+struct filt_context {
+  // z scratch, regrown only when a call needs more than any earlier one
+  std::optional<filt::memory_pool> pool;
+  std::string last_error;
+};
+
+namespace {
+
+// for failures of calls without a context, see filt_last_error
+thread_local std::string contextless_error;
+
+template<typename T, typename Buffer>
+filt::strided_rgb<T> to_strided(const Buffer* buffer, const char* what) {
+  if (!buffer || !buffer->data) {
+    throw fmt_runtime_error("{} buffer is null", what);
+  }
+  constexpr ptrdiff_t elem = sizeof(float);
+  if (buffer->stride_x_bytes % elem || buffer->stride_y_bytes % elem || buffer->stride_channel_bytes % elem) {
+    throw fmt_runtime_error("{} strides are not multiples of {} bytes", what, elem);
+  }
+  return filt::strided_rgb<T>{
+    .data = static_cast<T*>(buffer->data),
+    .stride_x = buffer->stride_x_bytes / elem,
+    .stride_y = buffer->stride_y_bytes / elem,
+    .stride_c = buffer->stride_channel_bytes / elem,
+  };
+}
+
+// bytes [lo, hi) that the float elements of `b` lie in
+template<typename Buffer>
+std::pair<const std::byte*, const std::byte*> extent(const Buffer& b, int width, int height) {
+  auto lo = static_cast<const std::byte*>(b.data);
+  auto hi = lo + sizeof(float);
+  for (auto [count, stride]: {
+         std::pair{ptrdiff_t(width), b.stride_x_bytes},
+         std::pair{ptrdiff_t(height), b.stride_y_bytes},
+         std::pair{ptrdiff_t(3), b.stride_channel_bytes}}) {
+    const ptrdiff_t span = (count - 1) * stride;
+    (span < 0 ? lo : hi) += span;
+  }
+  return {lo, hi};
+}
+
+// whether some float of `a` overlaps one of `b`: exact for equal strides, extents otherwise
+bool overlaps(const filt_buffer& a, const filt_const_buffer& b, int width, int height) {
+  const auto [a_lo, a_hi] = extent(a, width, height);
+  const auto [b_lo, b_hi] = extent(b, width, height);
+  if (a_hi <= b_lo || b_hi <= a_lo) {
+    return false;
+  }
+  if (a.stride_x_bytes != b.stride_x_bytes
+      || a.stride_y_bytes != b.stride_y_bytes
+      || a.stride_channel_bytes != b.stride_channel_bytes) {
+    return true;
+  }
+
+  constexpr ptrdiff_t elem = sizeof(float);
+  const ptrdiff_t base = static_cast<const std::byte*>(a.data) - static_cast<const std::byte*>(b.data);
+  const ptrdiff_t sx = a.stride_x_bytes;
+  for (ptrdiff_t dc = -2; dc <= 2; ++dc) {
+    for (ptrdiff_t dy = -(height - 1); dy <= height - 1; ++dy) {
+      const ptrdiff_t rest = base + dy * a.stride_y_bytes + dc * a.stride_channel_bytes;
+      if (sx == 0) {
+        if (std::abs(rest) < elem) {
+          return true;
+        }
+        continue;
+      }
+      // the dx that brings rest + dx * sx nearest to zero is one of these two
+      const ptrdiff_t near = -rest / sx;
+      for (ptrdiff_t dx: {near - 1, near, near + 1}) {
+        if (std::abs(dx) < width && std::abs(rest + dx * sx) < elem) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+filt::exp_variant to_exp_variant(filt_exp exp) {
+  switch (exp) {
+    case FILT_EXP_DEFAULT: return filt::filter_params{}.exp;
+    case FILT_EXP_EXACT: return filt::exp_variant::exact;
+    case FILT_EXP_BIT_TRICK: return filt::exp_variant::bit_trick;
+    case FILT_EXP_POLY3: return filt::exp_variant::poly3;
+    case FILT_EXP_LUT: return filt::exp_variant::lut;
+  }
+  throw fmt_runtime_error("unknown exp {}", int(exp));
+}
+
+void copy_border(const filt::strided_filter_streams& s, int width, int height) {
+  auto copy = [&](int x, int y) {
+    for (int c = 0; c < 3; ++c) {
+      s.dst.data[x * s.dst.stride_x + y * s.dst.stride_y + c * s.dst.stride_c] =
+        s.color.data[x * s.color.stride_x + y * s.color.stride_y + c * s.color.stride_c];
+    }
+  };
+  constexpr int r = filt::filter_radius;
+  for (int y = 0; y < height; ++y) {
+    const bool full_row = y < r || y >= height - r;
+    for (int x = 0; x < width; ++x) {
+      if (full_row || x < r || x >= width - r) {
+        copy(x, y);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+extern "C" {
+
+filt_context* filt_create(void) {
+  return new (std::nothrow) filt_context();
+}
+
+void filt_destroy(filt_context* context) {
+  delete context;
+}
+
+int filt_default_params(filt_params* params) {
+  if (!params) {
+    contextless_error = "params is null";
+    return -1;
+  }
+  const filt::filter_params defaults;
+  *params = filt_params{};
+  params->intensity_sigma = defaults.intensity_sigma;
+  params->min_normal_dot = defaults.min_normal_dot;
+  params->grain_rows = defaults.grain_rows;
+  return 0;
+}
+
+int filt_denoise(
+  filt_context* context,
+  int width,
+  int height,
+  const filt_const_buffer* color,
+  const filt_const_buffer* albedo,
+  const filt_const_buffer* normals,
+  const filt_buffer* output,
+  const filt_params* params
+) try {
+  if (!context) {
+    throw std::runtime_error("context is null");
+  }
+  if (width <= 0 || height <= 0) {
+    throw fmt_runtime_error("bad frame size {}×{}", width, height);
+  }
+
+  filt::image_meta meta;
+  meta.width = width;
+  meta.height = height;
+
+  const ptrdiff_t z_elems = 3 * meta.total_pixels();
+  const ptrdiff_t z_bytes = z_elems * ptrdiff_t(sizeof(float)) + 4096;
+  if (!context->pool || std::ssize(context->pool->memory) < z_bytes) {
+    context->pool.reset();
+    context->pool.emplace(z_bytes);
+  }
+  context->pool->release_to(0);
+
+  const filt::strided_filter_streams streams{
+    .dst = to_strided<float>(output, "output"),
+    .color = to_strided<const float>(color, "color"),
+    .albedo = to_strided<const float>(albedo, "albedo"),
+    .normals = to_strided<const float>(normals, "normals"),
+    .z = context->pool->allocate<float>(0, z_elems),
+  };
+
+  for (auto [input, what]: {std::pair{color, "color"}, {albedo, "albedo"}, {normals, "normals"}}) {
+    if (overlaps(*output, *input, width, height)) {
+      throw fmt_runtime_error("output overlaps {}", what);
+    }
+  }
+
+  filt::filter_params filter_params;
+  if (params) {
+    filter_params.intensity_sigma = params->intensity_sigma;
+    filter_params.min_normal_dot = params->min_normal_dot;
+    filter_params.grain_rows = params->grain_rows;
+    filter_params.exp = to_exp_variant(params->exp);
+    filter_params.luma_chroma = params->luma_chroma != 0;
+    if (std::ranges::any_of(params->reserved, [](int v) { return v != 0; })) {
+      throw std::runtime_error("reserved params are not zero");
+    }
+  }
+
+  filt::linear_filter(meta, streams, filt::rect{0, 0, width, height}, filter_params);
+  copy_border(streams, width, height);
+  return 0;
+} catch (const std::exception& ex) {
+  (context ? context->last_error : contextless_error) = ex.what();
+  return -1;
+}
+
+const char* filt_last_error(const filt_context* context) {
+  return (context ? context->last_error : contextless_error).c_str();
+}
+
+}  // extern "C"
\ No newline at end of file
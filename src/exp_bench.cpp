@@ -0,0 +1,133 @@
+#include "fastexp.hpp"
+#include "image.hpp"
+#include "mempool.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fmt/base.h>
+#include <fmt/color.h>
+#include <fmt/format.h>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Measures every exp_variant twice: the function alone over the arguments the intensity term
+// produces, then the whole filter against the output of the exact variant.
+//   exp_bench [input.exr]
+// Without an input, filters a synthetic 1920×1080 gbuffer. Exits with 1 if a variant is less
+// accurate than its max_relative_error, as it would be if the compiler folded its rounding.
+
+using dseconds = std::chrono::duration<double>;
+
+// best of `reps` runs of `f`, in seconds
+template<typename F>
+static double best_time(int reps, F&& f) {
+  double best = std::numeric_limits<double>::infinity();
+  for (int i = 0; i < reps; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    best = std::min(best, dseconds(std::chrono::steady_clock::now() - start).count());
+  }
+  return best;
+}
+
+// exp(-20) is ~2e-9, below that a weight no longer moves the sum; false if a variant is out
+// of its error bound
+static bool bench_function() {
+  constexpr int n = 1 << 20;
+  std::vector<float> args(n);
+  for (int i = 0; i < n; ++i) {
+    args[i] = -20.f * float(i) / n;
+  }
+  std::vector<float> results(n);
+
+  bool within_bounds = true;
+  fmt::println("function over [-20, 0]\tmax rel error\tmax abs error\tGexp/s");
+  for (filt::exp_variant v: filt::all_exp_variants) {
+    filt::with_exp(v, [&](auto exp) {
+      const double seconds = best_time(20, [&] {
+        for (int i = 0; i < n; ++i) {
+          results[i] = exp(args[i]);
+        }
+        asm volatile("" :: "r"(results.data()) : "memory");
+      });
+
+      double max_rel = 0;
+      double max_abs = 0;
+      for (int i = 0; i < n; ++i) {
+        const double exact = std::exp(double(args[i]));
+        const double error = std::abs(results[i] - exact);
+        max_abs = std::max(max_abs, error);
+        max_rel = std::max(max_rel, error / exact);
+      }
+      fmt::println("{}\t{:.3e}\t{:.3e}\t{:.3f}", to_string(v), max_rel, max_abs, n / seconds * 1e-9);
+      if (!(max_rel <= filt::max_relative_error(v))) {
+        fmt::print(
+          stderr, fg(fmt::terminal_color::red) | fmt::emphasis::bold,
+          "{} is off by {:.3e}, over its bound of {:.1e}\n",
+          to_string(v), max_rel, filt::max_relative_error(v));
+        within_bounds = false;
+      }
+    });
+  }
+  return within_bounds;
+}
+
+static void bench_filter(filt::image& gbuf) {
+  auto& meta = gbuf.meta;
+  auto pool = filt::memory_pool(filt::memory_pool::gbuffer_size_bytes(meta.total_pixels()));
+  auto streams = pool.upload_gbuffer(gbuf);
+
+  filt::filter_params params;
+  params.exp = filt::exp_variant::exact;
+  filt::linear_filter(meta, streams, params);
+  const std::vector<float> reference(streams.dst.begin(), streams.dst.end());
+
+  const filt::rect interior{
+    filt::filter_radius, filt::filter_radius,
+    meta.width - filt::filter_radius, meta.height - filt::filter_radius};
+
+  fmt::println("filter {}×{}\tMP/s\tPSNR dB\tmax abs error", meta.width, meta.height);
+  for (filt::exp_variant v: filt::all_exp_variants) {
+    params.exp = v;
+    const double seconds = best_time(5, [&] {
+      filt::linear_filter(meta, streams, params);
+    });
+
+    // PSNR of what ends up in the png, max error of the raw values
+    double squared = 0;
+    double max_abs = 0;
+    for (int y = interior.y0; y < interior.y1; ++y) {
+      for (int x = interior.x0; x < interior.x1; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          const ptrdiff_t at = 3 * (ptrdiff_t(y) * meta.width + x) + c;
+          const double error = std::clamp(streams.dst[at], 0.f, 1.f) - std::clamp(reference[at], 0.f, 1.f);
+          squared += error * error;
+          max_abs = std::max<double>(max_abs, std::abs(streams.dst[at] - reference[at]));
+        }
+      }
+    }
+    const double mse = squared / (3 * double(interior.width()) * interior.height());
+    // spelled out: -ffast-math assumes no infinities, so one would not print as inf
+    const std::string psnr = mse > 0 ? fmt::format("{:.2f}", -10 * std::log10(mse)) : "inf";
+    fmt::println("{}\t{:.3f}\t{}\t{:.3e}", to_string(v), meta.total_pixels() / seconds * 1e-6, psnr, max_abs);
+  }
+}
+
+int main(int argc, char** argv) try {
+  const bool within_bounds = bench_function();
+  fmt::println("");
+
+  auto gbuf = argc > 1
+    ? filt::image(argv[1], filt::is_gbuffer_channel)
+    : filt::image::make_synthetic_gbuffer(1920, 1080);
+  bench_filter(gbuf);
+  return within_bounds ? 0 : 1;
+
+} catch (const std::exception& ex) {
+  fmt::print(
+    stderr, fg(fmt::terminal_color::red) | fmt::emphasis::bold,
+    "Error: {}\n", ex.what());
+  return 1;
+}
\ No newline at end of file
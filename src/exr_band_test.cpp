@@ -0,0 +1,144 @@
+#include "image.hpp"
+#include "mempool.hpp"
+#include "roi.hpp"
+#include "stripes.hpp"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fmt/base.h>
+#include <fmt/format.h>
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfHeader.h>
+#include <ImfOutputFile.h>
+#include <span>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Writes a synthetic gbuffer to an exr and checks that the paths decoding it in bands filter the
+// pixels they cover exactly as linear_filter filters the whole frame. Exits with 1 if one does not.
+
+namespace {
+
+constexpr int width = 301;
+constexpr int height = 140;
+
+void write_exr(const char* path, const filt::image& gbuffer) {
+  Imf::Header header(gbuffer.meta.width, gbuffer.meta.height);
+  Imf::FrameBuffer framebuffer;
+  for (const filt::linear_channel& channel: gbuffer.meta.channels) {
+    header.channels().insert(channel.name.c_str(), Imf::Channel(Imf::FLOAT));
+    auto base = reinterpret_cast<const char*>(gbuffer.data.data() + channel.base_offset_elems());
+    framebuffer.insert(channel.name.c_str(), Imf::Slice(
+      Imf::FLOAT,
+      const_cast<char*>(base),
+      channel.stride_x_bytes,
+      channel.stride_y_bytes));
+  }
+  Imf::OutputFile file(path, header);
+  file.setFrameBuffer(framebuffer);
+  file.writePixels(gbuffer.meta.height);
+}
+
+std::vector<float> full_frame(const filt::image& gbuffer) {
+  filt::image_meta meta = gbuffer.meta;
+  auto pool = filt::memory_pool(filt::memory_pool::gbuffer_size_bytes(meta.total_pixels()));
+  auto streams = pool.upload_gbuffer(gbuffer);
+  filt::linear_filter(meta, streams);
+  return {streams.dst.begin(), streams.dst.end()};
+}
+
+// whether linear_filter writes pixel (x, y), rather than leaving it as it was
+bool filtered_by_full_frame(int x, int y) {
+  const ptrdiff_t flat = ptrdiff_t(y) * width + x;
+  const ptrdiff_t margin = filt::filter_radius * ptrdiff_t(width + 1);
+  return flat >= margin && flat < ptrdiff_t(width) * height - margin;
+}
+
+// the roi and full-frame loops may vectorize differently, and under -ffast-math division with them
+bool close(float got, float want) {
+  return std::abs(got - want) <= 1e-5f * std::max(1.f, std::abs(want));
+}
+
+bool check_roi(const char* path, std::span<const float> full) {
+  // against the edges, overlapping, and sharing a decoded band
+  const std::vector<filt::rect> rois = {
+    {0, 0, 40, 60}, {20, 30, 50, 50}, {width - 21, 100, width, 140},
+    {5, 130, width - 1, 140}, {10, 70, 30, 75}, {0, 0, width, 2},
+  };
+  constexpr float untouched = -1.f;
+  auto out = filt::image::make_rgb(width, height);
+  std::ranges::fill(out.data, untouched);
+  filt::memory_pool pool;
+  filt::roi_filter(path, rois, out, pool);
+
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const bool in_roi = std::ranges::any_of(rois, [&](const filt::rect& r) {
+        return x >= r.x0 && x < r.x1 && y >= r.y0 && y < r.y1;
+      });
+      for (int c = 0; c < 3; ++c) {
+        const float got = out.sample(c, x, y);
+        const float want = in_roi && filtered_by_full_frame(x, y)
+          ? full[3 * (ptrdiff_t(y) * width + x) + c]
+          : untouched;
+        if (!close(got, want)) {
+          fmt::println(stderr, "roi_filter: ({}, {}) channel {} is {} instead of {}", x, y, c, got, want);
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool check_stripes(const char* path, std::span<const float> full, filt::row_order order) {
+  const bool bottom_up = order == filt::row_order::bottom_up;
+  int expected_y = bottom_up ? height - 1 : 0;
+  bool ok = true;
+  filt::memory_pool pool;
+  filt::stripe_filter(
+    path, pool, 32,
+    [&](int y, std::span<const float>, std::span<const float> filtered) {
+      if (!ok) {
+        return;
+      }
+      if (y != expected_y) {
+        fmt::println(stderr, "stripe_filter: row {} came instead of {}", y, expected_y);
+        ok = false;
+        return;
+      }
+      expected_y += bottom_up ? -1 : 1;
+      for (int x = 0; x < width; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          const float got = filtered[3 * x + c];
+          const float want = filtered_by_full_frame(x, y) ? full[3 * (ptrdiff_t(y) * width + x) + c] : 0.f;
+          if (!close(got, want)) {
+            fmt::println(
+              stderr, "stripe_filter: ({}, {}) channel {} is {} instead of {}", x, y, c, got, want);
+            ok = false;
+            return;
+          }
+        }
+      }
+    },
+    {}, order);
+  return ok && expected_y == (bottom_up ? -1 : height);
+}
+
+}  // namespace
+
+int main() {
+  const auto gbuffer = filt::image::make_synthetic_gbuffer(width, height, 7);
+  const std::string path =
+    (std::filesystem::temp_directory_path() / fmt::format("exr_band_test_{}.exr", ::getpid())).string();
+  write_exr(path.c_str(), gbuffer);
+  const std::vector<float> full = full_frame(gbuffer);
+
+  const bool roi = check_roi(path.c_str(), full);
+  const bool top_down = check_stripes(path.c_str(), full, filt::row_order::top_down);
+  const bool bottom_up = check_stripes(path.c_str(), full, filt::row_order::bottom_up);
+  std::filesystem::remove(path);
+  return roi && top_down && bottom_up ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <string_view>
+
+namespace filt {
+
+// Approximations of exp(x) for the intensity edge-stopping weight, whose argument is never
+// positive. exp_bench times each over [-20, 0], fails if its relative error there exceeds
+// max_relative_error, and compares the image it filters with that of exact.
+enum class exp_variant {
+  exact,
+  bit_trick,
+  poly3,
+  lut,
+};
+
+constexpr std::array all_exp_variants = {
+  exp_variant::exact,
+  exp_variant::bit_trick,
+  exp_variant::poly3,
+  exp_variant::lut,
+};
+
+constexpr std::string_view to_string(exp_variant v) {
+  switch (v) {
+    case exp_variant::exact: return "exact";
+    case exp_variant::bit_trick: return "bit-trick";
+    case exp_variant::poly3: return "poly3";
+    case exp_variant::lut: return "lut";
+  }
+  __builtin_unreachable();
+}
+
+exp_variant parse_exp_variant(std::string_view name);
+
+// the documented bound on the relative error over [-20, 0], with or without -ffast-math
+constexpr double max_relative_error(exp_variant v) {
+  switch (v) {
+    case exp_variant::exact: return 1e-6;
+    case exp_variant::bit_trick: return 3.5e-2;
+    case exp_variant::poly3: return 2e-4;
+    case exp_variant::lut: return 1.5e-3;
+  }
+  __builtin_unreachable();
+}
+
+struct exact_exp {
+  float operator()(float x) const {
+    return std::exp(x);
+  }
+};
+
+// Schraudolph: scale and bias x straight into the exponent bits, ~4% error
+struct bit_trick_exp {
+  constexpr float operator()(float x) const {
+    constexpr float a = (1 << 23) / 0.69314718f;
+    constexpr float b = (1 << 23) * (127 - 0.043677448f);
+    // below 2^23 the bits are a denormal, which -ffast-math flushes to zero
+    x = std::clamp(a * x + b, 0.f, (1 << 23) * 255.f);
+    return std::bit_cast<float>(static_cast<uint32_t>(x));
+  }
+};
+
+// t + round_magic holds round(t) in its low mantissa bits; never subtract it back, -ffast-math
+// folds that to t
+constexpr float round_magic = 0x1.8p23f;
+constexpr int32_t round_magic_bits = 0x4b400000;
+
+// 2^floor(t) from the exponent bits times a cubic for 2^frac(t), ~1.5e-4 relative error
+struct poly3_exp {
+  float operator()(float x) const {
+    const float t = std::clamp(x * 1.44269504f, -126.f, 127.f);
+    // floor, not round_magic: the fraction needs the rounded value back as a float
+    const float whole = std::floor(t);
+    const float f = t - whole;
+    const float p = 1.f + f * (0.69606564f + f * (0.22449434f + f * 0.079440238f));
+    return std::bit_cast<float>(static_cast<uint32_t>(int32_t(whole) + 127) << 23) * p;
+  }
+};
+
+// 2^(k / 256) from a table for the fraction, rounded to the nearest entry, ~0.14% error
+struct lut_exp {
+  static constexpr int bits = 8;
+
+  static inline const std::array<float, 1 << bits> table = [] {
+    std::array<float, 1 << bits> result;
+    for (int k = 0; k < (1 << bits); ++k) {
+      result[k] = std::exp2(float(k) / (1 << bits));
+    }
+    return result;
+  }();
+
+  float operator()(float x) const {
+    const float t = std::clamp(x * 1.44269504f, -126.f, 126.f) * (1 << bits);
+    const int32_t k = std::bit_cast<int32_t>(t + round_magic) - round_magic_bits;
+    const float scale = std::bit_cast<float>(static_cast<uint32_t>((k >> bits) + 127) << 23);
+    return scale * table[k & ((1 << bits) - 1)];
+  }
+};
+
+// calls `f` with the functor of `v`, so the kernel is instantiated once per variant
+template<typename F>
+decltype(auto) with_exp(exp_variant v, F&& f) {
+  switch (v) {
+    case exp_variant::exact: return f(exact_exp{});
+    case exp_variant::bit_trick: return f(bit_trick_exp{});
+    case exp_variant::poly3: return f(poly3_exp{});
+    case exp_variant::lut: return f(lut_exp{});
+  }
+  __builtin_unreachable();
+}
+
+}  // namespace filt
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef FILT_H
+#define FILT_H
+
+/* Embeddable denoiser: filters caller-owned color, albedo and normal buffers into a caller-owned
+ * output buffer, with no file I/O and no copies of the inputs. Every buffer is 3-channel float,
+ * addressed like a linear_channel: channel c of pixel (x, y) starts at byte
+ *   data + x * stride_x_bytes + y * stride_y_bytes + c * stride_channel_bytes
+ * so interleaved, planar and padded-row layouts all work. Strides must be multiples of 4.
+ *
+ * Functions that can fail return 0 on success and -1 on failure, with the reason in
+ * filt_last_error of the context, or of NULL for calls made without one. */
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#  define FILT_API __attribute__((visibility("default")))
+#else
+#  define FILT_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct filt_buffer {
+  void* data;
+  ptrdiff_t stride_x_bytes;
+  ptrdiff_t stride_y_bytes;
+  ptrdiff_t stride_channel_bytes;
+} filt_buffer;
+
+/* An input, which the filter only reads. */
+typedef struct filt_const_buffer {
+  const void* data;
+  ptrdiff_t stride_x_bytes;
+  ptrdiff_t stride_y_bytes;
+  ptrdiff_t stride_channel_bytes;
+} filt_const_buffer;
+
+/* How the intensity weight evaluates exp; the approximations trade accuracy for speed. */
+typedef enum filt_exp {
+  FILT_EXP_DEFAULT = 0,
+  FILT_EXP_EXACT,
+  FILT_EXP_BIT_TRICK,
+  FILT_EXP_POLY3,
+  FILT_EXP_LUT,
+} filt_exp;
+
+/* Zero in a field after grain_rows means its default. */
+typedef struct filt_params {
+  float intensity_sigma;
+  float min_normal_dot;
+  int grain_rows;
+  filt_exp exp;
+  /* nonzero: filter YCoCg, with chroma sharing the intensity weights of luma */
+  int luma_chroma;
+  /* must be zero; room for later fields without changing the size */
+  int reserved[8];
+} filt_params;
+
+/* Owns the scratch memory, reused across calls; not thread-safe, use one per thread. */
+typedef struct filt_context filt_context;
+
+FILT_API filt_context* filt_create(void);
+FILT_API void filt_destroy(filt_context* context);
+
+/* Fails if params is NULL. Sets every field, reserved ones to zero. */
+FILT_API int filt_default_params(filt_params* params);
+
+/* Pixels closer than the filter radius to the border are copied from color unfiltered. params
+ * may be NULL for the defaults. The filter reads each input around a pixel after earlier pixels
+ * are written, so output must not share any float with color, albedo or normals: denoising in
+ * place is refused. Buffers may share an allocation, e.g. as channels of one interleaved image;
+ * ones with different strides must not even interleave. */
+FILT_API int filt_denoise(
+  filt_context* context,
+  int width,
+  int height,
+  const filt_const_buffer* color,
+  const filt_const_buffer* albedo,
+  const filt_const_buffer* normals,
+  const filt_buffer* output,
+  const filt_params* params);
+
+/* The reason for the last failure of a call given `context`; with NULL, of the calling thread's
+ * last call that had no context to report to. */
+FILT_API const char* filt_last_error(const filt_context* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
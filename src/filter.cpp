@@ -1,14 +1,18 @@
 #include "image.hpp"
 #include "util.hpp"
-#include <bit>
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iterator>
+#include <oneapi/tbb/blocked_range.h>
+#include <oneapi/tbb/parallel_for.h>
 #include <oneapi/tbb/parallel_for_each.h>
 #include <sched.h>
 #include <span>
+#include <string_view>
+#include <type_traits>
 
 #if 1
 #define unroll _Pragma("unroll")
@@ -18,7 +22,7 @@
 
 namespace filt {
 
-constexpr int radius = 3;
+constexpr int radius = filter_radius;
 using float3 = std::array<float, 3>;
 
 constexpr static float dot(const float3& a, const float3& b) {
@@ -39,14 +43,14 @@ image naive_filter(image& gbuf) {
   image_meta meta;
   meta.width = gbuf.meta.width;
   meta.height = gbuf.meta.height;
-  const int stride_x = sizeof(float);
-  const int stride_y = stride_x * meta.width;
+  const ptrdiff_t stride_x = sizeof(float);
+  const ptrdiff_t stride_y = stride_x * meta.width;
   for (int i = 0; i < 3; ++i) {
     const char name[2] = {"RGB"[i], '\0'};
     meta.channels.push_back(linear_channel{
       .name = name,
       .elem_width_bytes = sizeof(float),
-      .base_offset_bytes = i * int(sizeof(float)) * meta.total_pixels(),
+      .base_offset_bytes = i * ptrdiff_t(sizeof(float)) * meta.total_pixels(),
       .stride_x_bytes = stride_x,
       .stride_y_bytes = stride_y,
     });
@@ -54,7 +58,7 @@ image naive_filter(image& gbuf) {
     auto color = gbuf.get_channel_data(gbuf.meta.find_channel(name));
     auto albedo = gbuf.get_channel_data(
       gbuf.meta.find_channel(fmt::format("Albedo.{}", name)));
-    for (int j = 0; j < std::ssize(color); ++j) {
+    for (ptrdiff_t j = 0; j < std::ssize(color); ++j) {
       color[j] /= albedo[j];
     }
   }
@@ -145,63 +149,180 @@ image naive_filter(image& gbuf) {
 
 // =====================================================================
 
-static constexpr float approx_exp1(float x) {
-  constexpr float a = (1 << 23) / 0.69314718f;
-  constexpr float b = (1 << 23) * (127 - 0.043677448f);
-  x = a * x + b;
-  constexpr float c = (1 << 23);
-  constexpr float d = (1 << 23) * 255;
-  if (x < c) {
-    x = 0.0f;
-  } else if (x > d) {
-    x = d;
+exp_variant parse_exp_variant(std::string_view name) {
+  for (exp_variant v: all_exp_variants) {
+    if (to_string(v) == name) {
+      return v;
+    }
   }
-  return std::bit_cast<float>(static_cast<uint32_t>(x));
+  throw fmt_runtime_error("unknown exp variant {}", name);
 }
 
-void linear_filter(image_meta& meta, filter_streams s) {
-  const int total_pixels = meta.total_pixels();
-  assert_release(std::ssize(s.dst) == 3 * total_pixels);
-  assert_release(std::ssize(s.color) == 3 * total_pixels);
-  assert_release(std::ssize(s.albedo) == 3 * total_pixels);
-  assert_release(std::ssize(s.z) == 3 * total_pixels);
-  assert_release(std::ssize(s.normals) == 3 * total_pixels);
-
-  const int width = meta.width;
-
 #define RESTRICT __restrict
 // #define RESTRICT
-  float* RESTRICT z = s.z.data();
-  float* RESTRICT out = s.dst.data();
-  const float* RESTRICT normals = s.normals.data();
-  const float* RESTRICT albedo = s.albedo.data();
 
-  auto get_z = [&](int at) -> float3 {
-    float3 result;
-    std::memcpy(result.data(), z + 3 * at, sizeof(result));
-    return result;
-  };
+// a direction also stops where the normal turns by more than 1% against the previous step
+constexpr float normal_ratio_threshold = 1.01f;
 
-  auto get_albedo = [&](int at) -> float3 {
-    float3 result;
-    std::memcpy(result.data(), albedo + 3 * at, sizeof(result));
-    return result;
+static float spatial_weight(int i, int j) {
+  return std::exp((i*i + j*j) * (-1.f / (1 + 2 * radius)));
+}
+
+// YCoCg, exactly invertible with adds and halvings
+static float3 rgb_to_ycocg(const float3& rgb) {
+  return float3{
+    0.25f * rgb[0] + 0.5f * rgb[1] + 0.25f * rgb[2],
+    0.5f * rgb[0] - 0.5f * rgb[2],
+    -0.25f * rgb[0] + 0.5f * rgb[1] - 0.25f * rgb[2],
   };
+}
+
+static float3 ycocg_to_rgb(const float3& ycocg) {
+  const float t = ycocg[0] - ycocg[2];
+  return float3{t + ycocg[1], ycocg[0] + ycocg[2], t - ycocg[1]};
+}
+
+namespace {
 
-  auto get_normal = [&](int at) -> float3 {
+// Layouts map pixel (x, y) to the index of its first float; contiguous layouts keep the three
+// channels adjacent with compile-time strides, so a pixel loads as one 12-byte memcpy.
+
+struct interleaved_layout {
+  static constexpr bool contiguous = true;
+  ptrdiff_t stride_y;
+
+  ptrdiff_t offset(ptrdiff_t x, ptrdiff_t y) const {
+    return 3 * x + y * stride_y;
+  }
+};
+
+struct strided_layout {
+  static constexpr bool contiguous = false;
+  ptrdiff_t stride_x;
+  ptrdiff_t stride_y;
+  ptrdiff_t stride_c;
+
+  ptrdiff_t offset(ptrdiff_t x, ptrdiff_t y) const {
+    return x * stride_x + y * stride_y;
+  }
+};
+
+// see tiled_pixel_index
+template<int tile>
+struct tiled_layout {
+  static_assert(std::has_single_bit(unsigned(tile)));
+  static constexpr bool contiguous = true;
+  static constexpr int shift = std::countr_zero(unsigned(tile));
+  ptrdiff_t tiles_x;
+
+  ptrdiff_t offset(ptrdiff_t x, ptrdiff_t y) const {
+    const ptrdiff_t tile_index = (y >> shift) * tiles_x + (x >> shift);
+    return 3 * ((tile_index << (2 * shift)) + ((y & (tile - 1)) << shift) + (x & (tile - 1)));
+  }
+};
+
+// Inner with x wrapping into the previous or next row, as flat row-major indices do, for
+// neighbours at most one row width outside the frame.
+template<typename Inner>
+struct row_wrapping_layout {
+  static constexpr bool contiguous = Inner::contiguous;
+  Inner inner;
+  ptrdiff_t width;
+
+  ptrdiff_t offset(ptrdiff_t x, ptrdiff_t y) const {
+    if (x < 0) {
+      return inner.offset(x + width, y - 1);
+    }
+    if (x >= width) {
+      return inner.offset(x - width, y + 1);
+    }
+    return inner.offset(x, y);
+  }
+};
+
+template<typename T, typename Layout>
+struct stream3 {
+  T* RESTRICT data;
+  Layout layout;
+
+  ptrdiff_t offset(ptrdiff_t x, ptrdiff_t y) const {
+    return layout.offset(x, y);
+  }
+
+  float3 load(ptrdiff_t at) const {
     float3 result;
-    std::memcpy(result.data(), normals + 3 * at, sizeof(result));
+    if constexpr (Layout::contiguous) {
+      std::memcpy(result.data(), data + at, sizeof(result));
+    } else {
+      for (int k = 0; k < 3; ++k) {
+        result[k] = data[at + k * layout.stride_c];
+      }
+    }
     return result;
-  };
+  }
+
+  void store(ptrdiff_t at, const float3& value) const {
+    if constexpr (Layout::contiguous) {
+      std::memcpy(data + at, value.data(), sizeof(value));
+    } else {
+      for (int k = 0; k < 3; ++k) {
+        data[at + k * layout.stride_c] = value[k];
+      }
+    }
+  }
+};
+
+template<typename T>
+stream3<T, interleaved_layout> interleaved_stream(std::span<T> s, ptrdiff_t width) {
+  return {s.data(), interleaved_layout{3 * width}};
+}
+
+template<typename T>
+stream3<T, strided_layout> strided_stream(const strided_rgb<T>& s) {
+  return {s.data, strided_layout{s.stride_x, s.stride_y, s.stride_c}};
+}
+
+template<int tile, typename T>
+stream3<T, tiled_layout<tile>> tiled_stream(std::span<T> s, ptrdiff_t width) {
+  return {s.data(), tiled_layout<tile>{(width + tile - 1) / tile}};
+}
 
-  for (int i = 0; i < 3 * total_pixels; ++i) {
-    z[i] = s.color[i] / albedo[i];
+// color, albedo and out are only touched at the origin pixel; normals and z are read across the
+// whole neighbourhood, which is what a tiled layout is for. With LumaChroma, z holds YCoCg.
+template<typename IoLayout, typename NormalLayout, typename ZLayout, typename Exp, bool LumaChroma>
+struct linear_kernel {
+  static constexpr bool row_major_z = std::is_same_v<ZLayout, interleaved_layout>;
+
+  stream3<const float, IoLayout> color;
+  stream3<const float, IoLayout> albedo;
+  stream3<const float, NormalLayout> normals;
+  stream3<float, IoLayout> out;
+  stream3<float, ZLayout> z;
+  const float intensity_scale;
+  const float min_normal_dot;
+
+  // z = color / albedo for pixels [x0, x1) of row y
+  void demodulate(ptrdiff_t y, ptrdiff_t x0, ptrdiff_t x1) const {
+    if constexpr (std::is_same_v<IoLayout, interleaved_layout> && row_major_z && !LumaChroma) {
+      float* RESTRICT zrow = z.data + z.offset(x0, y);
+      const float* RESTRICT crow = color.data + color.offset(x0, y);
+      const float* RESTRICT arow = albedo.data + albedo.offset(x0, y);
+      for (ptrdiff_t i = 0; i < 3 * (x1 - x0); ++i) {
+        zrow[i] = crow[i] / arow[i];
+      }
+    } else {
+      for (ptrdiff_t x = x0; x < x1; ++x) {
+        float3 c = color.load(color.offset(x, y));
+        float3 a = albedo.load(albedo.offset(x, y));
+        float3 demodulated {c[0] / a[0], c[1] / a[1], c[2] / a[2]};
+        z.store(z.offset(x, y), LumaChroma ? rgb_to_ycocg(demodulated) : demodulated);
+      }
+    }
   }
 
-  const int redzone = radius * (width + 1);
-  for (int origin = redzone; origin < total_pixels - redzone; ++origin) {
-    float3 zorigin = get_z(origin);
-    float3 norigin = get_normal(origin);
+  void filter_pixel(ptrdiff_t x, ptrdiff_t y) const {
+    float3 zorigin = z.load(z.offset(x, y));
+    float3 norigin = normals.load(normals.offset(x, y));
     float3 value = zorigin;
     float3 weight {1.f, 1.f, 1.f};
 
@@ -212,27 +333,35 @@ void linear_filter(image_meta& meta, filter_streams s) {
       unroll for (int i = 1; i <= radius; ++i) {
         unroll for (int j = -i; j < +i; ++j) {
           auto [dx, dy] = rotate_ij(direction, i, j);
-          int offset = origin + dy * width + dx;
 
-          float3 nhere = get_normal(offset);
+          float3 nhere = normals.load(normals.offset(x + dx, y + dy));
 
           float ndot = dot(nprev, nhere);
-          constexpr float threshold = 1.01f;
-          if (ndot < 0.7f
+          constexpr float threshold = normal_ratio_threshold;
+          if (ndot < min_normal_dot
           || (i > 1 && (ndot > ndotprev * threshold || ndotprev > ndot * threshold))) {
             goto kill_direction;
           }
 
-          float gdist = std::exp((i*i + j*j) * (-1.f / (1 + 2 * radius)));
+          float gdist = spatial_weight(i, j);
 
-          float3 zhere = get_z(offset);
+          float3 zhere = z.load(z.offset(x + dx, y + dy));
 
-          unroll for (int k = 0; k < 3; ++k) {
-            float id = (zhere[k] - zorigin[k]);
-            float gintensity = approx_exp1(id * id * (-1.f / 25.f));
-            float factor = gdist * gintensity;
-            value[k] += zhere[k] * factor;
-            weight[k] += factor;
+          if constexpr (LumaChroma) {
+            float id = (zhere[0] - zorigin[0]);
+            float factor = gdist * Exp{}(id * id * intensity_scale);
+            unroll for (int k = 0; k < 3; ++k) {
+              value[k] += zhere[k] * factor;
+            }
+            weight[0] += factor;
+          } else {
+            unroll for (int k = 0; k < 3; ++k) {
+              float id = (zhere[k] - zorigin[k]);
+              float gintensity = Exp{}(id * id * intensity_scale);
+              float factor = gdist * gintensity;
+              value[k] += zhere[k] * factor;
+              weight[k] += factor;
+            }
           }
 
           if (j == 0) {
@@ -245,12 +374,356 @@ void linear_filter(image_meta& meta, filter_streams s) {
     kill_direction:;
     }
 
-    float3 alb = get_albedo(origin);
-    for (int i = 0; i < 3; ++i) {
-      float final = alb[i] * value[i] / weight[i];
-      out[3 * origin + i] = final;
+    float3 alb = albedo.load(albedo.offset(x, y));
+    float3 final;
+    if constexpr (LumaChroma) {
+      float3 rgb = ycocg_to_rgb(float3{value[0] / weight[0], value[1] / weight[0], value[2] / weight[0]});
+      for (int i = 0; i < 3; ++i) {
+        final[i] = alb[i] * rgb[i];
+      }
+    } else {
+      for (int i = 0; i < 3; ++i) {
+        final[i] = alb[i] * value[i] / weight[i];
+      }
     }
+    out.store(out.offset(x, y), final);
   }
+};
+
+template<typename T, typename Layout>
+stream3<T, row_wrapping_layout<Layout>> row_wrapping(const stream3<T, Layout>& s, ptrdiff_t width) {
+  return {s.data, row_wrapping_layout<Layout>{s.layout, width}};
+}
+
+// `kernel` with its guide streams wrapping around row ends
+template<typename IoLayout, typename NormalLayout, typename ZLayout, typename Exp, bool LumaChroma>
+auto row_wrapping(
+  const linear_kernel<IoLayout, NormalLayout, ZLayout, Exp, LumaChroma>& kernel,
+  ptrdiff_t width
+) {
+  using wrapping_normals = row_wrapping_layout<NormalLayout>;
+  using wrapping_z = row_wrapping_layout<ZLayout>;
+  return linear_kernel<IoLayout, wrapping_normals, wrapping_z, Exp, LumaChroma>{
+    .color = kernel.color,
+    .albedo = kernel.albedo,
+    .normals = row_wrapping(kernel.normals, width),
+    .out = kernel.out,
+    .z = row_wrapping(kernel.z, width),
+    .intensity_scale = kernel.intensity_scale,
+    .min_normal_dot = kernel.min_normal_dot,
+  };
+}
+
+// calls `f` with std::bool_constant<value>
+template<typename F>
+void with_bool(bool value, F&& f) {
+  if (value) {
+    f(std::true_type{});
+  } else {
+    f(std::false_type{});
+  }
+}
+
+// calls `f` with the kernel matching the layout of `s`
+template<typename F>
+void with_kernel(const image_meta& meta, const filter_streams& s, const filter_params& params, F&& f) {
+  const ptrdiff_t width = meta.width;
+  const ptrdiff_t total_pixels = meta.total_pixels();
+  const ptrdiff_t guide_pixels = tiled_pixel_count(meta.width, meta.height, s.tile_size);
+  assert_release(std::ssize(s.dst) == 3 * total_pixels);
+  assert_release(std::ssize(s.color) == 3 * total_pixels);
+  assert_release(std::ssize(s.albedo) == 3 * total_pixels);
+  assert_release(std::ssize(s.z) == 3 * guide_pixels);
+  assert_release(std::ssize(s.normals) == 3 * guide_pixels);
+
+  auto make = [&](auto guide_stream) {
+    using guide_layout = decltype(guide_stream(s.z).layout);
+    with_exp(params.exp, [&]<typename Exp>(Exp) {
+      with_bool(params.luma_chroma, [&]<bool LumaChroma>(std::bool_constant<LumaChroma>) {
+        f(linear_kernel<interleaved_layout, guide_layout, guide_layout, Exp, LumaChroma>{
+          .color = interleaved_stream(s.color, width),
+          .albedo = interleaved_stream(s.albedo, width),
+          .normals = guide_stream(s.normals),
+          .out = interleaved_stream(s.dst, width),
+          .z = guide_stream(s.z),
+          .intensity_scale = -1.f / (params.intensity_sigma * params.intensity_sigma),
+          .min_normal_dot = params.min_normal_dot,
+        });
+      });
+    });
+  };
+
+  switch (s.tile_size) {
+    case 0: return make([&](auto span) { return interleaved_stream(span, width); });
+    case 8: return make([&](auto span) { return tiled_stream<8>(span, width); });
+    case 16: return make([&](auto span) { return tiled_stream<16>(span, width); });
+  }
+  throw fmt_runtime_error("unsupported tile size {}", s.tile_size);
+}
+
+template<typename F>
+void with_kernel(
+  const image_meta& meta,
+  const strided_filter_streams& s,
+  const filter_params& params,
+  F&& f
+) {
+  assert_release(std::ssize(s.z) == 3 * meta.total_pixels());
+  with_exp(params.exp, [&]<typename Exp>(Exp) {
+    with_bool(params.luma_chroma, [&]<bool LumaChroma>(std::bool_constant<LumaChroma>) {
+      f(linear_kernel<strided_layout, strided_layout, interleaved_layout, Exp, LumaChroma>{
+        .color = strided_stream(s.color),
+        .albedo = strided_stream(s.albedo),
+        .normals = strided_stream(s.normals),
+        .out = strided_stream(s.dst),
+        .z = interleaved_stream(s.z, meta.width),
+        .intensity_scale = -1.f / (params.intensity_sigma * params.intensity_sigma),
+        .min_normal_dot = params.min_normal_dot,
+      });
+    });
+  });
+}
+
+template<typename Kernel>
+void filter_roi(const image_meta& meta, const Kernel& kernel, rect roi, int grain) {
+  roi = roi.intersect(rect{radius, radius, meta.width - radius, meta.height - radius});
+  if (roi.empty()) {
+    return;
+  }
+
+  const rect halo = roi.inflate(radius);
+  tbb::parallel_for(
+    tbb::blocked_range<int>(halo.y0, halo.y1, grain),
+    [&](const tbb::blocked_range<int>& rows) {
+      for (int y = rows.begin(); y < rows.end(); ++y) {
+        kernel.demodulate(y, halo.x0, halo.x1);
+      }
+    });
+
+  tbb::parallel_for(
+    tbb::blocked_range<int>(roi.y0, roi.y1, grain),
+    [&](const tbb::blocked_range<int>& rows) {
+      for (int y = rows.begin(); y < rows.end(); ++y) {
+        for (int x = roi.x0; x < roi.x1; ++x) {
+          kernel.filter_pixel(x, y);
+        }
+      }
+    });
+}
+
+// the pixels of `area` whose neighbours are in bounds as flat indices, as in the full frame
+template<typename Kernel>
+void filter_full_frame(
+  const image_meta& meta,
+  const Kernel& kernel,
+  int first_row,
+  int frame_height,
+  rect area,
+  int grain
+) {
+  const int width = meta.width;
+  area = area.intersect(rect{0, radius, width, frame_height - radius});
+  if (area.empty()) {
+    return;
+  }
+
+  tbb::parallel_for(
+    tbb::blocked_range<int>(0, meta.height, grain),
+    [&](const tbb::blocked_range<int>& rows) {
+      for (int y = rows.begin(); y < rows.end(); ++y) {
+        kernel.demodulate(y, 0, width);
+      }
+    });
+
+  // tiles are not in flat order, so neighbourhoods crossing a row end wrap explicitly
+  const auto wrapping = row_wrapping(kernel, width);
+  tbb::parallel_for(
+    tbb::blocked_range<int>(area.y0, area.y1, grain),
+    [&](const tbb::blocked_range<int>& rows) {
+      for (int y = rows.begin(); y < rows.end(); ++y) {
+        const int x0 = y == radius ? std::max(area.x0, radius) : area.x0;
+        const int x1 = y == frame_height - radius - 1 ? std::min(area.x1, width - radius) : area.x1;
+        const int local_y = y - first_row;
+        if constexpr (Kernel::row_major_z) {
+          for (int x = x0; x < x1; ++x) {
+            kernel.filter_pixel(x, local_y);
+          }
+        } else {
+          const int left = std::clamp(radius, x0, std::max(x0, x1));
+          const int right = std::clamp(width - radius, left, std::max(left, x1));
+          for (int x = x0; x < left; ++x) {
+            wrapping.filter_pixel(x, local_y);
+          }
+          for (int x = left; x < right; ++x) {
+            kernel.filter_pixel(x, local_y);
+          }
+          for (int x = right; x < x1; ++x) {
+            wrapping.filter_pixel(x, local_y);
+          }
+        }
+      }
+    });
+}
+
+}  // namespace
+
+void linear_filter(image_meta& meta, filter_streams s, const filter_params& params) {
+  const int grain = std::max(1, params.grain_rows);
+  with_kernel(meta, s, params, [&](const auto& kernel) {
+    filter_full_frame(meta, kernel, 0, meta.height, rect{0, 0, meta.width, meta.height}, grain);
+  });
+}
+
+void linear_filter_band(
+  image_meta& meta,
+  filter_streams s,
+  int frame_height,
+  rect area,
+  const filter_params& params
+) {
+  const int grain = std::max(1, params.grain_rows);
+  with_kernel(meta, s, params, [&](const auto& kernel) {
+    filter_full_frame(meta, kernel, meta.first_row, frame_height, area, grain);
+  });
+}
+
+void linear_filter(image_meta& meta, filter_streams s, rect roi, const filter_params& params) {
+  with_kernel(meta, s, params, [&](const auto& kernel) {
+    filter_roi(meta, kernel, roi, std::max(1, params.grain_rows));
+  });
+}
+
+void linear_filter(image_meta& meta, strided_filter_streams s, rect roi, const filter_params& params) {
+  with_kernel(meta, s, params, [&](const auto& kernel) {
+    filter_roi(meta, kernel, roi, std::max(1, params.grain_rows));
+  });
+}
+
+// =====================================================================
+
+namespace {
+
+// every neighbour of the widest possible neighbourhood: 2i taps per ring per direction
+constexpr int max_taps = 4 * radius * (radius + 1);
+
+struct tap {
+  ptrdiff_t offset;
+  float gdist;
+};
+
+// the neighbours of `origin` that survive the normal edge-stopping, with their spatial weights
+int gather_taps(
+  const float* RESTRICT normals,
+  ptrdiff_t width,
+  ptrdiff_t origin,
+  float min_normal_dot,
+  std::array<tap, max_taps>& taps
+) {
+  auto get_normal = [&](ptrdiff_t at) {
+    float3 result;
+    std::memcpy(result.data(), normals + 3 * at, sizeof(result));
+    return result;
+  };
+
+  int count = 0;
+  const float3 norigin = get_normal(origin);
+  unroll for (int direction = 0; direction < 4; ++direction) {
+    float3 nprev = norigin;
+    float ndotprev;
+
+    unroll for (int i = 1; i <= radius; ++i) {
+      unroll for (int j = -i; j < +i; ++j) {
+        auto [dx, dy] = rotate_ij(direction, i, j);
+        ptrdiff_t offset = origin + dy * width + dx;
+        float3 nhere = get_normal(offset);
+
+        float ndot = dot(nprev, nhere);
+        constexpr float threshold = normal_ratio_threshold;
+        if (ndot < min_normal_dot
+        || (i > 1 && (ndot > ndotprev * threshold || ndotprev > ndot * threshold))) {
+          goto kill_direction;
+        }
+
+        taps[count++] = tap{offset, spatial_weight(i, j)};
+
+        if (j == 0) {
+          nprev = nhere;
+          ndotprev = ndot;
+        }
+      }
+    }
+
+  kill_direction:;
+  }
+  return count;
+}
+
+}  // namespace
+
+void linear_filter_multi(
+  image_meta& meta,
+  std::span<const float> albedo,
+  std::span<const float> normals,
+  std::span<const aov_target> targets,
+  const filter_params& params
+) {
+  const ptrdiff_t width = meta.width;
+  const ptrdiff_t total_pixels = meta.total_pixels();
+  const ptrdiff_t grain = std::max<ptrdiff_t>(1, ptrdiff_t(params.grain_rows) * width);
+  const float intensity_scale = -1.f / (params.intensity_sigma * params.intensity_sigma);
+  assert_release(std::ssize(normals) == 3 * total_pixels);
+
+  for (const aov_target& target: targets) {
+    const ptrdiff_t elems = target.channels * total_pixels;
+    assert_release(target.channels > 0);
+    assert_release(std::ssize(target.color) == elems);
+    assert_release(std::ssize(target.dst) == elems);
+    if (target.demodulate) {
+      assert_release(target.channels == 3);
+      assert_release(std::ssize(albedo) == elems);
+      assert_release(std::ssize(target.z) == elems);
+      tbb::parallel_for(
+        tbb::blocked_range<ptrdiff_t>(0, elems, 3 * grain),
+        [&](const tbb::blocked_range<ptrdiff_t>& range) {
+          for (ptrdiff_t i = range.begin(); i < range.end(); ++i) {
+            target.z[i] = target.color[i] / albedo[i];
+          }
+        });
+    }
+  }
+
+  const ptrdiff_t redzone = radius * (width + 1);
+  with_exp(params.exp, [&](auto exp) {
+    tbb::parallel_for(
+      tbb::blocked_range<ptrdiff_t>(redzone, std::max(redzone, total_pixels - redzone), grain),
+      [&](const tbb::blocked_range<ptrdiff_t>& range) {
+        std::array<tap, max_taps> taps;
+        for (ptrdiff_t origin = range.begin(); origin < range.end(); ++origin) {
+          const int ntaps = gather_taps(normals.data(), width, origin, params.min_normal_dot, taps);
+
+          for (const aov_target& target: targets) {
+            const int nc = target.channels;
+            const float* RESTRICT src = target.demodulate ? target.z.data() : target.color.data();
+            for (int c = 0; c < nc; ++c) {
+              const float zorigin = src[nc * origin + c];
+              float value = zorigin;
+              float weight = 1.f;
+              for (int t = 0; t < ntaps; ++t) {
+                float zhere = src[nc * taps[t].offset + c];
+                float id = zhere - zorigin;
+                float factor = taps[t].gdist * exp(id * id * intensity_scale);
+                value += zhere * factor;
+                weight += factor;
+              }
+              if (target.demodulate) {
+                value *= albedo[3 * origin + c];
+              }
+              target.dst[nc * origin + c] = value / weight;
+            }
+          }
+        }
+      });
+  });
 }
 
 }  // namespace filt
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
 
+#include "fastexp.hpp"
 #include "util.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 #include <functional>
+#include <memory>
 #include <span>
 #include <string>
 #include <string_view>
@@ -14,30 +18,71 @@ namespace filt {
 
 using boost::container::small_vector;
 
+// neighbourhood half-size of linear_filter
+constexpr int filter_radius = 3;
+
+// half-open [x0, x1) × [y0, y1)
+struct rect {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+
+  int width() const {
+    return x1 - x0;
+  }
+
+  int height() const {
+    return y1 - y0;
+  }
+
+  bool empty() const {
+    return x0 >= x1 || y0 >= y1;
+  }
+
+  rect intersect(const rect& other) const {
+    return rect{
+      std::max(x0, other.x0),
+      std::max(y0, other.y0),
+      std::min(x1, other.x1),
+      std::min(y1, other.y1),
+    };
+  }
+
+  rect inflate(int by) const {
+    return rect{x0 - by, y0 - by, x1 + by, y1 + by};
+  }
+
+  rect translate(int dx, int dy) const {
+    return rect{x0 + dx, y0 + dy, x1 + dx, y1 + dy};
+  }
+};
+
 struct linear_channel {
   std::string name;
 
+  // byte offsets are 64-bit: planar channels of a gigapixel frame are several GiB apart
   int elem_width_bytes;
-  int base_offset_bytes;
-  int stride_x_bytes;
-  int stride_y_bytes;
+  ptrdiff_t base_offset_bytes;
+  ptrdiff_t stride_x_bytes;
+  ptrdiff_t stride_y_bytes;
 
-  int base_offset_elems() const {
+  ptrdiff_t base_offset_elems() const {
     assert(base_offset_bytes % elem_width_bytes == 0);
     return base_offset_bytes / elem_width_bytes;
   }
 
-  int stride_x_elems() const {
+  ptrdiff_t stride_x_elems() const {
     assert(stride_x_bytes % elem_width_bytes == 0);
     return stride_x_bytes / elem_width_bytes;
   }
 
-  int stride_y_elems() const {
+  ptrdiff_t stride_y_elems() const {
     assert(stride_y_bytes % elem_width_bytes == 0);
     return stride_y_bytes / elem_width_bytes;
   }
 
-  int offset_elems(int x, int y) const {
+  ptrdiff_t offset_elems(int x, int y) const {
     return base_offset_elems()
         + x * stride_x_elems()
         + y * stride_y_elems();
@@ -47,14 +92,16 @@ struct linear_channel {
 struct image_meta {
   int width;
   int height;
+  // scanline of the source frame that is stored in row 0, nonzero for partially read images
+  int first_row = 0;
   small_vector<linear_channel, 16> channels;
 
-  int total_pixels() const {
-    return width * height;
+  ptrdiff_t total_pixels() const {
+    return ptrdiff_t(width) * height;
   }
 
-  int storage_size() const {
-    return total_pixels() * channels.size();
+  ptrdiff_t storage_size() const {
+    return total_pixels() * std::ssize(channels);
   }
 
   int find_channel_idx(std::string_view name) const;
@@ -73,12 +120,25 @@ struct image: noncopyable {
   );
   explicit image(const char* exr_filename);
 
+  // reads only scanlines [row_begin, row_end) of the frame, clamped to its data window
+  image(
+    const char* exr_filename,
+    const std::function<bool(std::string_view)> channel_filter,
+    int row_begin,
+    int row_end
+  );
+
   explicit image(image_meta m):
     meta(std::move(m)),
     data(meta.storage_size())
   {}
 
   static image make_rgb(int width, int height);
+  // an 8-bit png such as dump_png_rgb writes, as make_rgb channels
+  static image load_png_rgb(const char* path);
+  // a noisy render of flat-shaded random planes with the channels of a real gbuffer, for
+  // benchmarking without an exr at hand; the same seed always gives the same image
+  static image make_synthetic_gbuffer(int width, int height, unsigned seed = 1);
 
   float sample(const linear_channel& channel, int x, int y) const {
     return data[channel.offset_elems(x, y)];
@@ -97,8 +157,51 @@ struct image: noncopyable {
   std::vector<unsigned char> data_to_u8() const;
 };
 
+// 8-bit png straight from an interleaved rgb stream such as filter_streams::dst
+void dump_png_rgb_interleaved(const char* path, int width, int height, std::span<const float> rgb);
+
+// frame size of the EXR without reading any pixels
+rect exr_data_window(const char* exr_filename);
+
+// an exr kept open across row ranges, so the header is parsed once and read-ahead carries over
+class exr_reader: nonmovable {
+  struct impl;
+  std::unique_ptr<impl> state;
+
+public:
+  explicit exr_reader(const char* exr_filename);
+  ~exr_reader();
+
+  rect data_window() const;
+
+  // the same as image(exr_filename, channel_filter, row_begin, row_end)
+  image read(const std::function<bool(std::string_view)>& channel_filter, int row_begin, int row_end);
+};
+
+// true for the channels linear_filter consumes: R, G, B, Albedo.*, Ns.*
+bool is_gbuffer_channel(std::string_view name);
+
 [[nodiscard]] image naive_filter(image& gbuffer);
 
+// layout of normals and z: row-major, or row-major tile_size × tile_size tiles in row-major order
+inline ptrdiff_t tiled_pixel_index(int width, int tile_size, int x, int y) {
+  if (tile_size == 0) {
+    return ptrdiff_t(y) * width + x;
+  }
+  const ptrdiff_t tiles_x = (width + tile_size - 1) / tile_size;
+  const ptrdiff_t tile_index = (y / tile_size) * tiles_x + x / tile_size;
+  return tile_index * tile_size * tile_size + (y % tile_size) * tile_size + x % tile_size;
+}
+
+inline ptrdiff_t tiled_pixel_count(int width, int height, int tile_size) {
+  if (tile_size == 0) {
+    return ptrdiff_t(width) * height;
+  }
+  const ptrdiff_t tiles_x = (width + tile_size - 1) / tile_size;
+  const ptrdiff_t tiles_y = (height + tile_size - 1) / tile_size;
+  return tiles_x * tiles_y * tile_size * tile_size;
+}
+
 struct filter_streams {
   // all interleaved 1,2,3,1,2,3,..
   std::span<float> dst;
@@ -106,7 +209,78 @@ struct filter_streams {
   std::span<const float> albedo;
   std::span<const float> normals;
   std::span<float> z;
+  // layout of normals and z, see tiled_pixel_index; 8 or 16 when tiled
+  int tile_size = 0;
+};
+
+struct filter_params {
+  // scale of the intensity edge-stopping term, in units of demodulated color
+  float intensity_sigma = 5.f;
+  // a neighbour whose normal is further than this (cosine) from the previous one stops its direction
+  float min_normal_dot = 0.7f;
+  // rows per tbb task
+  int grain_rows = 8;
+  // how the intensity term evaluates exp
+  exp_variant exp = exp_variant::bit_trick;
+  // YCoCg, chroma sharing luma's intensity weight: one exp per tap, not three; linear_filter only
+  bool luma_chroma = false;
 };
-void linear_filter(image_meta& meta, filter_streams streams);
+
+void linear_filter(image_meta& meta, filter_streams streams, const filter_params& params = {});
+
+// linear_filter's output over `area` (frame coordinates) from streams holding rows from meta.first_row,
+// which need filter_radius + 1 rows around it as the kernel wraps around row ends
+void linear_filter_band(
+  image_meta& meta,
+  filter_streams streams,
+  int frame_height,
+  rect area,
+  const filter_params& params = {});
+
+// only the pixels of `roi` (stream coordinates) whose whole neighbourhood lies inside the streams
+void linear_filter(image_meta& meta, filter_streams streams, rect roi, const filter_params& params = {});
+
+// one AOV of a multi-target filter: `channels` interleaved floats per pixel
+struct aov_target {
+  std::span<const float> color;
+  std::span<float> dst;
+  int channels;
+  // by albedo, like linear_filter's color; needs channels == 3 and z scratch of the same size
+  bool demodulate = false;
+  std::span<float> z = {};
+};
+
+// linear_filter of every target, sharing one normal edge-stopping pass; albedo only if one demodulates
+void linear_filter_multi(
+  image_meta& meta,
+  std::span<const float> albedo,
+  std::span<const float> normals,
+  std::span<const aov_target> targets,
+  const filter_params& params = {});
+
+// channel c of pixel (x, y) is data[x * stride_x + y * stride_y + c * stride_c], strides in floats
+template<typename T>
+struct strided_rgb {
+  T* data;
+  ptrdiff_t stride_x;
+  ptrdiff_t stride_y;
+  ptrdiff_t stride_c;
+};
+
+struct strided_filter_streams {
+  strided_rgb<float> dst;
+  strided_rgb<const float> color;
+  strided_rgb<const float> albedo;
+  strided_rgb<const float> normals;
+  // interleaved scratch, 3 * total_pixels
+  std::span<float> z;
+};
+
+// the roi variant over caller-owned buffers, read and written in place through their strides
+void linear_filter(
+  image_meta& meta,
+  strided_filter_streams streams,
+  rect roi,
+  const filter_params& params = {});
 
 }  // namespace filt
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include "incremental.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <utility>
+#include <oneapi/tbb/blocked_range.h>
+#include <oneapi/tbb/parallel_for.h>
+
+namespace filt {
+
+namespace {
+
+using stream_channels = std::array<linear_channel, 3>;
+
+std::array<stream_channels, 3> gbuffer_channels(const image_meta& meta) {
+  return {{
+    {meta.find_channel("R"), meta.find_channel("G"), meta.find_channel("B")},
+    {meta.find_channel("Albedo.R"), meta.find_channel("Albedo.G"), meta.find_channel("Albedo.B")},
+    {meta.find_channel("Ns.X"), meta.find_channel("Ns.Y"), meta.find_channel("Ns.Z")},
+  }};
+}
+
+// whether the pixels of `tile` in `channels` differ bitwise from the interleaved `stream`
+bool tile_differs(
+  const image& gbuffer,
+  const stream_channels& channels,
+  std::span<const float> stream,
+  const rect& tile
+) {
+  const ptrdiff_t width = gbuffer.meta.width;
+  for (int c = 0; c < 3; ++c) {
+    for (int y = tile.y0; y < tile.y1; ++y) {
+      const float* src = gbuffer.data.data() + channels[c].offset_elems(tile.x0, y);
+      const ptrdiff_t stride = channels[c].stride_x_elems();
+      const float* resident = stream.data() + 3 * (y * width + tile.x0) + c;
+      uint32_t diff = 0;
+      for (int x = 0; x < tile.width(); ++x) {
+        diff |= std::bit_cast<uint32_t>(src[x * stride]) ^ std::bit_cast<uint32_t>(resident[3 * x]);
+      }
+      if (diff != 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void upload_tile(
+  const image& gbuffer,
+  const stream_channels& channels,
+  std::span<float> stream,
+  const rect& tile
+) {
+  const ptrdiff_t width = gbuffer.meta.width;
+  for (int c = 0; c < 3; ++c) {
+    const ptrdiff_t stride = channels[c].stride_x_elems();
+    for (int y = tile.y0; y < tile.y1; ++y) {
+      const float* src = gbuffer.data.data() + channels[c].offset_elems(tile.x0, y);
+      float* dst = stream.data() + 3 * (y * width + tile.x0) + c;
+      for (int x = 0; x < tile.width(); ++x) {
+        dst[3 * x] = src[x * stride];
+      }
+    }
+  }
+}
+
+}  // namespace
+
+std::vector<rect> merge_dirty_tiles(
+  std::span<const char> dirty,
+  int tiles_x,
+  int tile_size,
+  int width,
+  int height
+) {
+  const rect frame{0, 0, width, height};
+  const int tiles_y = int(std::ssize(dirty) / tiles_x);
+  std::vector<rect> result;
+  // indices into `result` of the rects that reach down to the previous tile row
+  std::vector<ptrdiff_t> open;
+  std::vector<ptrdiff_t> next_open;
+  for (int ty = 0; ty < tiles_y; ++ty) {
+    next_open.clear();
+    for (int tx = 0; tx < tiles_x;) {
+      if (!dirty[ptrdiff_t(ty) * tiles_x + tx]) {
+        ++tx;
+        continue;
+      }
+      const int run_begin = tx;
+      while (tx < tiles_x && dirty[ptrdiff_t(ty) * tiles_x + tx]) {
+        ++tx;
+      }
+      const rect run = rect{
+        run_begin * tile_size, ty * tile_size, tx * tile_size, (ty + 1) * tile_size,
+      }.intersect(frame);
+
+      auto above = std::ranges::find_if(open, [&](ptrdiff_t i) {
+        return result[i].x0 == run.x0 && result[i].x1 == run.x1;
+      });
+      if (above != open.end()) {
+        result[*above].y1 = run.y1;
+        next_open.push_back(*above);
+      } else {
+        next_open.push_back(std::ssize(result));
+        result.push_back(run);
+      }
+    }
+    std::swap(open, next_open);
+  }
+  return result;
+}
+
+incremental_filter::incremental_filter(
+  int width,
+  int height,
+  const filter_params& p,
+  int tile
+):
+  params(p),
+  tile_size(std::max(1, tile)),
+  tiles_x((width + tile_size - 1) / tile_size),
+  tiles_y((height + tile_size - 1) / tile_size),
+  pool(memory_pool::gbuffer_size_bytes(ptrdiff_t(width) * height)),
+  dirty(ptrdiff_t(tiles_x) * tiles_y)
+{
+  meta.width = width;
+  meta.height = height;
+
+  // same placement as memory_pool::upload_gbuffer
+  const gbuffer_placement placement;
+  const ptrdiff_t elems = 3 * meta.total_pixels();
+  inputs[0] = pool.allocate<float>(placement.color, elems);
+  inputs[1] = pool.allocate<float>(placement.albedo, elems);
+  inputs[2] = pool.allocate<float>(placement.normals, elems);
+  streams.color = inputs[0];
+  streams.albedo = inputs[1];
+  streams.normals = inputs[2];
+  streams.dst = pool.allocate<float>(placement.dst, elems);
+  streams.z = pool.allocate<float>(placement.z, elems);
+}
+
+rect incremental_filter::tile_rect(int t) const {
+  const int tx = t % tiles_x;
+  const int ty = t / tiles_x;
+  return rect{tx * tile_size, ty * tile_size, (tx + 1) * tile_size, (ty + 1) * tile_size}
+    .intersect(rect{0, 0, meta.width, meta.height});
+}
+
+void incremental_filter::refilter_dirty() {
+  const rect frame{0, 0, meta.width, meta.height};
+  for (const rect& tiles: merge_dirty_tiles(dirty, tiles_x, tile_size, meta.width, meta.height)) {
+    // a changed input pixel moves the output up to filter_radius away
+    const rect r = tiles.inflate(filter_radius).intersect(frame);
+    if (r.x0 >= filter_radius && r.x1 <= meta.width - filter_radius) {
+      linear_filter(meta, streams, r, params);
+      continue;
+    }
+
+    // the full-frame kernel wraps around row ends, so an edge change reaches the adjacent rows
+    const rect area{0, std::max(0, r.y0 - 1), meta.width, std::min(meta.height, r.y1 + 1)};
+    const int y0 = std::max(0, area.y0 - filter_radius - 1);
+    const int y1 = std::min(meta.height, area.y1 + filter_radius + 1);
+    image_meta band = meta;
+    band.first_row = y0;
+    band.height = y1 - y0;
+    const ptrdiff_t offset = 3 * ptrdiff_t(y0) * meta.width;
+    const ptrdiff_t count = 3 * band.total_pixels();
+    filter_streams band_streams = {
+      .dst = streams.dst.subspan(offset, count),
+      .color = streams.color.subspan(offset, count),
+      .albedo = streams.albedo.subspan(offset, count),
+      .normals = streams.normals.subspan(offset, count),
+      .z = streams.z.subspan(offset, count),
+    };
+    linear_filter_band(band, band_streams, meta.height, area, params);
+  }
+  primed = true;
+}
+
+int incremental_filter::update(const image& gbuffer) {
+  assert_release(gbuffer.meta.width == meta.width && gbuffer.meta.height == meta.height);
+  const auto channels = gbuffer_channels(gbuffer.meta);
+
+  tbb::parallel_for(
+    tbb::blocked_range<int>(0, tile_count()),
+    [&](const tbb::blocked_range<int>& range) {
+      for (int t = range.begin(); t < range.end(); ++t) {
+        const rect tile = tile_rect(t);
+
+        bool changed = !primed;
+        for (int s = 0; s < 3 && !changed; ++s) {
+          changed = tile_differs(gbuffer, channels[s], inputs[s], tile);
+        }
+        dirty[t] = changed;
+        if (changed) {
+          for (int s = 0; s < 3; ++s) {
+            upload_tile(gbuffer, channels[s], inputs[s], tile);
+          }
+        }
+      }
+    });
+
+  refilter_dirty();
+  return std::ranges::count(dirty, true);
+}
+
+int incremental_filter::update(const image& gbuffer, std::span<const rect> changed) {
+  if (!primed) {
+    return update(gbuffer);
+  }
+  assert_release(gbuffer.meta.width == meta.width && gbuffer.meta.height == meta.height);
+  const auto channels = gbuffer_channels(gbuffer.meta);
+
+  std::ranges::fill(dirty, false);
+  for (const rect& r: changed) {
+    const rect clipped = r.intersect(rect{0, 0, meta.width, meta.height});
+    if (clipped.empty()) {
+      continue;
+    }
+    for (int ty = clipped.y0 / tile_size; ty <= (clipped.y1 - 1) / tile_size; ++ty) {
+      for (int tx = clipped.x0 / tile_size; tx <= (clipped.x1 - 1) / tile_size; ++tx) {
+        dirty[ptrdiff_t(ty) * tiles_x + tx] = true;
+      }
+    }
+  }
+
+  tbb::parallel_for(
+    tbb::blocked_range<int>(0, tile_count()),
+    [&](const tbb::blocked_range<int>& range) {
+      for (int t = range.begin(); t < range.end(); ++t) {
+        if (!dirty[t]) {
+          continue;
+        }
+        const rect tile = tile_rect(t);
+        for (int s = 0; s < 3; ++s) {
+          upload_tile(gbuffer, channels[s], inputs[s], tile);
+        }
+      }
+    });
+
+  refilter_dirty();
+  return std::ranges::count(dirty, true);
+}
+
+}  // namespace filt
\ No newline at end of file
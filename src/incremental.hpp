@@ -0,0 +1,55 @@
+#pragma once
+#include "image.hpp"
+#include "mempool.hpp"
+#include "util.hpp"
+#include <array>
+#include <span>
+#include <vector>
+
+namespace filt {
+
+// keeps a sequence of same-sized frames resident, re-filtering only around the tiles that change
+class incremental_filter: nonmovable {
+  image_meta meta;
+  filter_params params;
+  int tile_size;
+  int tiles_x;
+  int tiles_y;
+  memory_pool pool;
+  // writable views of the color, albedo and normals of `streams`
+  std::array<std::span<float>, 3> inputs;
+  filter_streams streams;
+  bool primed = false;
+  std::vector<char> dirty;
+
+  rect tile_rect(int t) const;
+  void refilter_dirty();
+
+public:
+  incremental_filter(int width, int height, const filter_params& params = {}, int tile_size = 32);
+
+  // changed tiles found by a bitwise compare with the resident inputs; returns how many there were
+  int update(const image& gbuffer);
+
+  // the same for a caller that knows the changes are confined to `changed`, skipping the compare
+  int update(const image& gbuffer, std::span<const rect> changed);
+
+  int tile_count() const {
+    return tiles_x * tiles_y;
+  }
+
+  // interleaved rgb of the latest frame, as linear_filter would filter it
+  std::span<const float> output() const {
+    return streams.dst;
+  }
+};
+
+// rects covering the set tiles of `dirty`: runs along a tile row, extended down while the run repeats
+std::vector<rect> merge_dirty_tiles(
+  std::span<const char> dirty,
+  int tiles_x,
+  int tile_size,
+  int width,
+  int height);
+
+}  // namespace filt
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "image.hpp"
+#include "incremental.hpp"
+#include "mempool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fmt/base.h>
+#include <fmt/ranges.h>
+#include <span>
+#include <tuple>
+#include <vector>
+
+// checks the dirty tile merge and that incremental_filter matches linear_filter of every frame
+
+namespace {
+
+bool check_merge() {
+  // 37×45 pixels in 8×8 tiles: 5×6 tiles, the last column and row clipped
+  constexpr int tiles_x = 5;
+  constexpr int tiles_y = 6;
+  std::vector<char> dirty(tiles_x * tiles_y);
+  auto set = [&](int tx, int ty) {
+    dirty[ty * tiles_x + tx] = true;
+  };
+  for (int ty = 1; ty < 5; ++ty) {
+    set(2, ty);
+  }
+  for (int ty = 0; ty < tiles_y; ++ty) {
+    set(4, ty);
+  }
+
+  // the right column comes first, as it starts in the first tile row
+  const auto rects = filt::merge_dirty_tiles(dirty, tiles_x, 8, 37, 45);
+  auto as_tuple = [](const filt::rect& r) {
+    return std::tuple(r.x0, r.y0, r.x1, r.y1);
+  };
+  const std::vector<filt::rect> expected = {{32, 0, 37, 45}, {16, 8, 24, 40}};
+  const bool ok = std::ranges::equal(rects, expected, {}, as_tuple, as_tuple);
+  if (!ok) {
+    fmt::println(stderr, "two dirty tile columns merged into {} rects:", rects.size());
+    for (const filt::rect& r: rects) {
+      fmt::println(stderr, "  {}", as_tuple(r));
+    }
+  }
+  return ok;
+}
+
+std::vector<float> full_frame(const filt::image& gbuffer) {
+  filt::image_meta meta = gbuffer.meta;
+  auto pool = filt::memory_pool(filt::memory_pool::gbuffer_size_bytes(meta.total_pixels()));
+  auto streams = pool.upload_gbuffer(gbuffer);
+  filt::linear_filter(meta, streams);
+  return {streams.dst.begin(), streams.dst.end()};
+}
+
+// refiltered rects may round differently from the full frame under -ffast-math
+bool same_output(std::span<const float> got, std::span<const float> want, const char* step) {
+  for (ptrdiff_t i = 0; i < std::ssize(want); ++i) {
+    if (!(std::abs(got[i] - want[i]) <= 1e-5f * std::max(1.f, std::abs(want[i])))) {
+      fmt::println(stderr, "{}: element {} is {} instead of {}", step, i, got[i], want[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool check_incremental() {
+  constexpr int width = 333;
+  constexpr int height = 217;
+  auto gbuffer = filt::image::make_synthetic_gbuffer(width, height, 5);
+  filt::incremental_filter incremental(width, height);
+
+  incremental.update(gbuffer);
+  if (!same_output(incremental.output(), full_frame(gbuffer), "first frame")) {
+    return false;
+  }
+
+  // an interior change, and ones against the left and the right edge
+  const auto& red = gbuffer.meta.find_channel("R");
+  const auto& normal_x = gbuffer.meta.find_channel("Ns.X");
+  for (int y = 100; y < 110; ++y) {
+    for (int x = 40; x < 47; ++x) {
+      gbuffer.data[red.offset_elems(x, y)] += 0.5f;
+    }
+  }
+  gbuffer.data[normal_x.offset_elems(0, 60)] = 0.9f;
+  gbuffer.data[red.offset_elems(width - 1, height - 5)] *= 3.f;
+  incremental.update(gbuffer);
+  if (!same_output(incremental.output(), full_frame(gbuffer), "compared update")) {
+    return false;
+  }
+
+  const filt::rect changed{200, 150, 230, 160};
+  for (int y = changed.y0; y < changed.y1; ++y) {
+    for (int x = changed.x0; x < changed.x1; ++x) {
+      gbuffer.data[red.offset_elems(x, y)] *= 0.3f;
+    }
+  }
+  incremental.update(gbuffer, std::span(&changed, 1));
+  return same_output(incremental.output(), full_frame(gbuffer), "update of a known rect");
+}
+
+}  // namespace
+
+int main() {
+  const bool merged = check_merge();
+  const bool incremental = check_incremental();
+  return merged && incremental ? 0 : 1;
+}
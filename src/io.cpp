@@ -1,6 +1,9 @@
 #include "image.hpp"
+#include "png_writer.hpp"
+#include "uring.hpp"
 #include "util.hpp"
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <fmt/base.h>
@@ -11,8 +14,9 @@
 #include <ImfHeader.h>
 #include <ImfInputFile.h>
 #include <iterator>
+#include <limits>
 #include <oneapi/tbb/parallel_for_each.h>
-#include <png.h>
+#include <random>
 #include <sched.h>
 #include <span>
 #include <stdexcept>
@@ -20,93 +24,29 @@
 #include <tbb/parallel_for_each.h>
 #include <vector>
 
-class png_writer {
-  png_structp write_struct = nullptr;
-  png_infop info_struct = nullptr;
-  FILE* out_stream = nullptr;
-
-  void cleanup() {
-    // libpng cleanup is messy, so do it all here
-    png_destroy_write_struct(&write_struct, &info_struct);
-    if (out_stream) {
-      fclose(out_stream);
-      out_stream = nullptr;
-    }
-  }
-
-public:
-  explicit png_writer(const char* filename) {
-    try {
-      write_struct = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-      if (!write_struct) {
-        throw std::runtime_error("cannot create libpng write struct");
-      }
-      info_struct = png_create_info_struct(write_struct);
-      if (!info_struct) {
-        throw std::runtime_error("cannot create libpng info struct");
-      }
-      out_stream = fopen(filename, "wb");
-      if (!out_stream) {
-        throw errno_error("open png file");
-      }
-    } catch (...) {
-      cleanup();
-      throw;
-    }
-
-    png_init_io(write_struct, out_stream);
-  }
-
-  ~png_writer() {
-    cleanup();
-  }
-
-  png_writer(png_writer&&) = delete;
-  png_writer(const png_writer&) = delete;
-  png_writer& operator=(png_writer&&) = delete;
-  png_writer& operator=(const png_writer&) = delete;
-
-  void write(int width, std::span<const unsigned char* const> rows, int color_type) && {
-    int height = std::ssize(rows);
-    png_set_IHDR(
-      write_struct,
-      info_struct,
-      width, height, 8,
-      color_type,
-      PNG_INTERLACE_NONE,
-      PNG_COMPRESSION_TYPE_DEFAULT,
-      PNG_FILTER_TYPE_DEFAULT);
-    png_write_info(write_struct, info_struct);
-    png_write_image(write_struct, const_cast<unsigned char**>(rows.data()));
-    png_write_end(write_struct, nullptr);
-  }
-
-  void write_grayscale(int width, std::span<const unsigned char* const> rows) && {
-    return std::move(*this).write(width, rows, PNG_COLOR_TYPE_GRAY);
-  }
-
-  void write_rgb_interleaved(int width, std::span<const unsigned char* const> rows) && {
-    return std::move(*this).write(width, rows, PNG_COLOR_TYPE_RGB);
-  }
-};
-
 namespace filt {
 
 static image_meta meta_from_exr(
   Imf::InputFile& imf_image,
-  const std::function<bool(std::string_view)> channel_filter
+  const std::function<bool(std::string_view)> channel_filter,
+  int row_begin,
+  int row_end
 ) {
   const auto imf_window = imf_image.header().dataWindow();
   const auto imf_size = imf_window.size() + Imath::V2i(1, 1);
   auto& imf_channels = imf_image.header().channels();
 
+  row_begin = std::clamp(row_begin, 0, imf_size.y);
+  row_end = std::clamp(row_end, row_begin, imf_size.y);
+
   image_meta meta;
   meta.width = imf_size.x;
-  meta.height = imf_size.y;
+  meta.height = row_end - row_begin;
+  meta.first_row = row_begin;
 
-  const int stride_x_bytes = sizeof(float);
-  const int stride_y_bytes = meta.width * stride_x_bytes;
-  int current_base_offset = 0;
+  const ptrdiff_t stride_x_bytes = sizeof(float);
+  const ptrdiff_t stride_y_bytes = meta.width * stride_x_bytes;
+  ptrdiff_t current_base_offset = 0;
 
   for (auto c = imf_channels.begin(); c != imf_channels.end(); ++c) {
     std::string name = c.name();
@@ -129,7 +69,7 @@ static image_meta meta_from_exr(
       .stride_x_bytes = stride_x_bytes,
       .stride_y_bytes = stride_y_bytes,
     });
-    current_base_offset += sizeof(float) * meta.width * meta.height;
+    current_base_offset += sizeof(float) * meta.total_pixels();
   }
 
   return meta;
@@ -147,47 +87,107 @@ int image_meta::find_channel_idx(std::string_view name) const {
 image::image(
   const char* exr_filename,
   const std::function<bool(std::string_view)> channel_filter
+):
+  image(exr_filename, channel_filter, 0, std::numeric_limits<int>::max())
+{}
+
+image::image(const char* exr_filename):
+  image(exr_filename, [](std::string_view) { return true; })
+{}
+
+image::image(
+  const char* exr_filename,
+  const std::function<bool(std::string_view)> channel_filter,
+  int row_begin,
+  int row_end
+):
+  image(exr_reader(exr_filename).read(channel_filter, row_begin, row_end))
+{}
+
+rect exr_data_window(const char* exr_filename) {
+  return exr_reader(exr_filename).data_window();
+}
+
+struct exr_reader::impl {
+  uring_istream stream;
+  Imf::InputFile exr;
+
+  explicit impl(const char* exr_filename):
+    stream(exr_filename),
+    exr(stream)
+  {}
+};
+
+exr_reader::exr_reader(const char* exr_filename):
+  state(std::make_unique<impl>(exr_filename))
+{}
+
+exr_reader::~exr_reader() = default;
+
+rect exr_reader::data_window() const {
+  const auto imf_size = state->exr.header().dataWindow().size() + Imath::V2i(1, 1);
+  return rect{0, 0, imf_size.x, imf_size.y};
+}
+
+image exr_reader::read(
+  const std::function<bool(std::string_view)>& channel_filter,
+  int row_begin,
+  int row_end
 ) {
-  auto exr = Imf::InputFile(exr_filename);
-  meta = meta_from_exr(exr, channel_filter);
+  Imf::InputFile& exr = state->exr;
+  auto result = image(meta_from_exr(exr, channel_filter, row_begin, row_end));
+  const image_meta& meta = result.meta;
 
   if (meta.channels.empty()) {
     throw std::runtime_error("No spectral channels in image");
   }
+  if (meta.height == 0) {
+    return result;
+  }
 
-  data.resize(meta.storage_size());
+  // slices are addressed with absolute frame coordinates, so shift the base pointers back
+  // by the data window origin and the rows that are not being read
+  const auto window_min = exr.header().dataWindow().min;
+  const int first_scanline = window_min.y + meta.first_row;
 
   Imf::FrameBuffer framebuffer;
   for (const linear_channel& channel: meta.channels) {
+    char* base = reinterpret_cast<char*>(result.data.data() + channel.base_offset_elems())
+      - window_min.x * channel.stride_x_bytes
+      - first_scanline * channel.stride_y_bytes;
     framebuffer.insert(channel.name.c_str(), Imf::Slice(
       Imf::FLOAT,
-      reinterpret_cast<char*>(data.data() + channel.base_offset_elems()),
+      base,
       channel.stride_x_bytes,
       channel.stride_y_bytes));
   }
 
   exr.setFrameBuffer(framebuffer);
-  exr.readPixels(0, meta.height-1);
+  exr.readPixels(first_scanline, first_scanline + meta.height - 1);
 
-  log_out("Done reading image {}", exr_filename);
+  log_out("Done reading rows [{}, {}) of image {}",
+    meta.first_row, meta.first_row + meta.height, exr.fileName());
+  return result;
 }
 
-image::image(const char* exr_filename):
-  image(exr_filename, [](std::string_view) { return true; })
-{}
+bool is_gbuffer_channel(std::string_view name) {
+  return name == "R" || name == "G" || name == "B"
+      || name.starts_with("Albedo.")
+      || name.starts_with("Ns.");
+}
 
 image image::make_rgb(int width, int height) {
   image_meta meta;
   meta.width = width;
   meta.height = height;
-  const int stride_x = sizeof(float);
-  const int stride_y = stride_x * meta.width;
+  const ptrdiff_t stride_x = sizeof(float);
+  const ptrdiff_t stride_y = stride_x * meta.width;
   for (int i = 0; i < 3; ++i) {
     const char name[2] = {"RGB"[i], '\0'};
     meta.channels.push_back(linear_channel{
       .name = name,
       .elem_width_bytes = sizeof(float),
-      .base_offset_bytes = i * int(sizeof(float)) * meta.total_pixels(),
+      .base_offset_bytes = i * ptrdiff_t(sizeof(float)) * meta.total_pixels(),
       .stride_x_bytes = stride_x,
       .stride_y_bytes = stride_y,
     });
@@ -195,6 +195,85 @@ image image::make_rgb(int width, int height) {
   return image(std::move(meta));
 }
 
+image image::load_png_rgb(const char* path) {
+  png_image png = {};
+  png.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_file(&png, path)) {
+    throw fmt_runtime_error("cannot read {}: {}", path, png.message);
+  }
+  png.format = PNG_FORMAT_RGB;
+  std::vector<unsigned char> all_data(PNG_IMAGE_SIZE(png));
+  if (!png_image_finish_read(&png, nullptr, all_data.data(), 0, nullptr)) {
+    throw fmt_runtime_error("cannot read {}: {}", path, png.message);
+  }
+
+  auto result = make_rgb(png.width, png.height);
+  // the middle of each 8-bit step, which clamp_float_value turns back into the same byte
+  for (int i = 0; i < 3; ++i) {
+    const ptrdiff_t base = result.meta.channels[i].base_offset_elems();
+    for (ptrdiff_t j = 0; j < result.meta.total_pixels(); ++j) {
+      result.data[base + j] = (all_data[3 * j + i] + 0.5f) / 255.f;
+    }
+  }
+  return result;
+}
+
+image image::make_synthetic_gbuffer(int width, int height, unsigned seed) {
+  constexpr const char* names[9] = {
+    "R", "G", "B",
+    "Albedo.R", "Albedo.G", "Albedo.B",
+    "Ns.X", "Ns.Y", "Ns.Z",
+  };
+  image_meta meta;
+  meta.width = width;
+  meta.height = height;
+  for (int i = 0; i < 9; ++i) {
+    meta.channels.push_back(linear_channel{
+      .name = names[i],
+      .elem_width_bytes = sizeof(float),
+      .base_offset_bytes = i * ptrdiff_t(sizeof(float)) * meta.total_pixels(),
+      .stride_x_bytes = sizeof(float),
+      .stride_y_bytes = ptrdiff_t(sizeof(float)) * meta.width,
+    });
+  }
+  image result(std::move(meta));
+
+  // blocks of 48x32 pixels, each a plane with its own normal and albedo
+  constexpr int block_w = 48;
+  constexpr int block_h = 32;
+  const int blocks_x = (width + block_w - 1) / block_w;
+  const int blocks_y = (height + block_h - 1) / block_h;
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  std::vector<std::array<float, 6>> blocks(ptrdiff_t(blocks_x) * blocks_y);
+  for (auto& block: blocks) {
+    float nx = uniform(rng) - 0.5f;
+    float ny = uniform(rng) - 0.5f;
+    float nz = 1.f / std::sqrt(nx * nx + ny * ny + 1.f);
+    const float r = 0.1f + 0.8f * uniform(rng);
+    const float g = 0.1f + 0.8f * uniform(rng);
+    const float b = 0.1f + 0.8f * uniform(rng);
+    block = {nx * nz, ny * nz, nz, r, g, b};
+  }
+
+  std::normal_distribution<float> noise(0.f, 0.15f);
+  const ptrdiff_t plane = result.meta.total_pixels();
+  float* data = result.data.data();
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const auto& block = blocks[ptrdiff_t(y / block_h) * blocks_x + x / block_w];
+      const ptrdiff_t at = ptrdiff_t(y) * width + x;
+      const float shade = 0.3f + 0.7f * block[2];
+      for (int c = 0; c < 3; ++c) {
+        data[6 * plane + c * plane + at] = block[c];
+        data[3 * plane + c * plane + at] = block[3 + c];
+        data[c * plane + at] = std::max(0.f, block[3 + c] * shade * (1.f + noise(rng)));
+      }
+    }
+  }
+  return result;
+}
+
 void image::put_channel_data(const linear_channel& channel, std::span<const float> newdata) {
   assert_release(channel.stride_x_elems() == 1);
   assert_release(channel.stride_y_elems() == meta.width);
@@ -210,13 +289,9 @@ std::span<float> image::get_channel_data(const linear_channel& channel) {
     meta.total_pixels());
 }
 
-static uint8_t clamp_float_value(float f) {
-  return std::clamp(f, 0.f, 1.0f) * 255.f;
-}
-
 void image::dump_pngs_prefix(std::string_view prefix) const {
   std::vector<unsigned char> all_data(data.size());
-  for (int i = 0; i < std::ssize(data); ++i) {
+  for (ptrdiff_t i = 0; i < std::ssize(data); ++i) {
     all_data[i] = clamp_float_value(data[i]);
   }
 
@@ -248,8 +323,8 @@ void image::dump_png_rgb(const char* path) const {
   }
 
   // interleave
-  int offset = 0;
-  for (int i = 0; i < meta.total_pixels(); ++i) {
+  ptrdiff_t offset = 0;
+  for (ptrdiff_t i = 0; i < meta.total_pixels(); ++i) {
     for (auto& channel: channels) {
       all_data[offset++] = clamp_float_value(data[channel.base_offset_elems() + i]);
     }
@@ -259,10 +334,23 @@ void image::dump_png_rgb(const char* path) const {
   std::vector<const unsigned char*> rows(meta.height);
   for (int i = 0; i < meta.height; ++i) {
     rows[i] = reinterpret_cast<const unsigned char*>(all_data.data())
-      + 3 * i * meta.width;
+      + 3 * ptrdiff_t(i) * meta.width;
   }
   png_writer(path).write_rgb_interleaved(meta.width, rows);
   log_out("Done writing rgb image {} on cpu {}", path, sched_getcpu());
 }
 
+void dump_png_rgb_interleaved(const char* path, int width, int height, std::span<const float> rgb) {
+  assert_release(std::ssize(rgb) == 3 * ptrdiff_t(width) * height);
+  std::vector<unsigned char> all_data(rgb.size());
+  std::ranges::transform(rgb, all_data.begin(), clamp_float_value);
+
+  std::vector<const unsigned char*> rows(height);
+  for (int i = 0; i < height; ++i) {
+    rows[i] = all_data.data() + 3 * ptrdiff_t(i) * width;
+  }
+  png_writer(path).write_rgb_interleaved(width, rows);
+  log_out("Done writing rgb image {} on cpu {}", path, sched_getcpu());
+}
+
 }  // namespace filt
\ No newline at end of file
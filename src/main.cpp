@@ -1,19 +1,37 @@
+#include "batch.hpp"
+#include "cache.hpp"
 #include "image.hpp"
+#include "incremental.hpp"
 #include "mempool.hpp"
+#include "numa.hpp"
+#include "png_writer.hpp"
+#include "raw_output.hpp"
+#include "roi.hpp"
+#include "server.hpp"
+#include "stripes.hpp"
+#include "tune.hpp"
 #include "util.hpp"
 #include <algorithm>
+#include <array>
+#include <charconv>
 #include <chrono>
 #include <csignal>
+#include <cstdint>
 #include <cstdlib>
 #include <fmt/base.h>
 #include <fmt/color.h>
 #include <fmt/ranges.h>
+#include <oneapi/tbb/global_control.h>
 #include <oneapi/tbb/parallel_for.h>
 #include <oneapi/tbb/parallel_for_each.h>
 #include <oneapi/tbb/task_group.h>
 #include <sched.h>
+#include <optional>
+#include <ranges>
+#include <string>
 #include <string_view>
 #include <unistd.h>
+#include <vector>
 
 
 using dmicroseconds = std::chrono::duration<double, std::micro>;
@@ -36,18 +54,22 @@ struct interval_timer {
 };
 
 
-static void deinterleave3(std::span<float> dst, std::span<const float> src) {
+static void deinterleave(std::span<float> dst, std::span<const float> src, int channels) {
   assert_release(dst.size() == src.size());
-  const int size = std::ssize(dst);
-  assert_release(size % 3 == 0);
-  const int nsize = size/3;
-  for (int i = 0; i < 3; ++i) {
-    for (int j = 0; j < nsize; ++j) {
-      dst[j + nsize*i] = src[3*j + i];
+  const ptrdiff_t size = std::ssize(dst);
+  assert_release(size % channels == 0);
+  const ptrdiff_t nsize = size/channels;
+  for (int i = 0; i < channels; ++i) {
+    for (ptrdiff_t j = 0; j < nsize; ++j) {
+      dst[j + nsize*i] = src[channels*j + i];
     }
   }
 }
 
+static void deinterleave3(std::span<float> dst, std::span<const float> src) {
+  deinterleave(dst, src, 3);
+}
+
 [[maybe_unused]]
 static void remove_non_rgb_channels(filt::image_meta& meta) {
    meta.channels.erase(
@@ -65,69 +87,577 @@ static void remove_non_rgb_channels(filt::image_meta& meta) {
     meta.channels.end());
 }
 
-int main(int argc, char** argv) try {
-  if (argc < 2) {
-    throw std::runtime_error("No input image filename");
+// "x0,y0,x1,y1"
+static filt::rect parse_rect(std::string_view text) {
+  filt::rect result;
+  int* fields[4] = {&result.x0, &result.y0, &result.x1, &result.y1};
+  const char* at = text.data();
+  const char* end = text.data() + text.size();
+  for (int i = 0; i < 4; ++i) {
+    if (i > 0 && (at == end || *at++ != ',')) {
+      throw fmt_runtime_error("Bad rectangle {}, expected x0,y0,x1,y1", text);
+    }
+    auto [next, ec] = std::from_chars(at, end, *fields[i]);
+    if (ec != std::errc()) {
+      throw fmt_runtime_error("Bad rectangle {}, expected x0,y0,x1,y1", text);
+    }
+    at = next;
+  }
+  if (at != end) {
+    throw fmt_runtime_error("Bad rectangle {}, expected x0,y0,x1,y1", text);
+  }
+  return result;
+}
+
+static int parse_int(std::string_view text) {
+  int result;
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), result);
+  if (ec != std::errc() || end != text.data() + text.size()) {
+    throw fmt_runtime_error("Bad integer {}", text);
+  }
+  return result;
+}
+
+// "diffuse.R,diffuse.G,diffuse.B"
+static std::vector<std::string> parse_names(std::string_view text) {
+  std::vector<std::string> result;
+  for (auto name: std::views::split(text, ',')) {
+    if (name.empty()) {
+      throw fmt_runtime_error("Empty channel name in {}", text);
+    }
+    result.emplace_back(name.begin(), name.end());
   }
+  return result;
+}
 
-  auto gbuf = filt::image(argv[1]);
+struct aov_option {
+  std::vector<std::string> channels;
+  bool demodulate;
+};
+
+struct options {
+  const char* input = nullptr;
+  // every input with --batch, the first of which is also `input`
+  std::vector<const char*> batch;
+  bool batch_mode = false;
+  std::vector<filt::rect> rois;
+  // earlier output the rois are patched into and written back to, instead of a black out/roi.png
+  const char* patch = nullptr;
+  bool out_of_core = false;
+  int stripe_rows = 0;
+  const char* cache = nullptr;
+  bool numa = false;
+  int tile_size = 0;
+  std::vector<aov_option> aovs;
+  filt::filter_params params;
+  int threads = 0;
+  const char* serve = nullptr;
+  filt::server_options server;
+  // tune for this host and store the result, instead of only loading what was stored
+  bool autotune = false;
+  // memory_pool::plan_gbuffer offsets instead of the hand-picked ones
+  bool plan_placement = false;
+  std::vector<const char*> updates;
+  // "-" for stdout
+  const char* raw = nullptr;
+  filt::raw_format raw_format = filt::raw_format::f32;
+  // knobs given on the command line, which win over the tuned configuration
+  std::optional<int> tile_size_arg;
+  std::optional<filt::exp_variant> exp_arg;
+
+  static options parse(int argc, char** argv) {
+    options result;
+    for (int i = 1; i < argc; ++i) {
+      std::string_view arg = argv[i];
+      auto value = [&] {
+        if (i + 1 >= argc) {
+          throw fmt_runtime_error("Missing value for {}", arg);
+        }
+        return std::string_view(argv[++i]);
+      };
+
+      if (arg == "--roi") {
+        result.rois.push_back(parse_rect(value()));
+      } else if (arg == "--patch") {
+        result.patch = value().data();
+      } else if (arg == "--out-of-core") {
+        result.out_of_core = true;
+      } else if (arg == "--serve") {
+        result.serve = value().data();
+      } else if (arg == "--pool-mib") {
+        // parse_int already refuses what does not fit an int, and that many MiB fits ptrdiff_t
+        const int mib = parse_int(value());
+        if (mib <= 0) {
+          throw fmt_runtime_error("--pool-mib must be positive, got {}", mib);
+        }
+        result.server.pool_bytes = ptrdiff_t(mib) << 20;
+      } else if (arg == "--threads") {
+        result.server.threads = parse_int(value());
+        if (result.server.threads < 0) {
+          throw fmt_runtime_error("--threads must not be negative, got {}", result.server.threads);
+        }
+      } else if (arg == "--aov") {
+        result.aovs.push_back(aov_option{parse_names(value()), false});
+      } else if (arg == "--aov-demodulated") {
+        result.aovs.push_back(aov_option{parse_names(value()), true});
+        if (result.aovs.back().channels.size() != 3) {
+          throw std::runtime_error("--aov-demodulated needs exactly 3 channels");
+        }
+      } else if (arg == "--tile") {
+        result.tile_size_arg = parse_int(value());
+        if (result.tile_size_arg != 0 && result.tile_size_arg != 8 && result.tile_size_arg != 16) {
+          throw fmt_runtime_error("--tile must be 0, 8 or 16, got {}", *result.tile_size_arg);
+        }
+      } else if (arg == "--exp") {
+        result.exp_arg = filt::parse_exp_variant(value());
+      } else if (arg == "--update") {
+        result.updates.push_back(value().data());
+      } else if (arg == "--luma-chroma") {
+        result.params.luma_chroma = true;
+      } else if (arg == "--autotune" || arg == "--retune") {
+        result.autotune = true;
+      } else if (arg == "--plan-placement") {
+        result.plan_placement = true;
+      } else if (arg == "--numa") {
+        result.numa = true;
+      } else if (arg == "--cache") {
+        result.cache = value().data();
+      } else if (arg == "--stripe-rows") {
+        result.out_of_core = true;
+        result.stripe_rows = parse_int(value());
+      } else if (arg == "--raw") {
+        result.raw = value().data();
+      } else if (arg == "--raw-format") {
+        result.raw_format = filt::parse_raw_format(value());
+      } else if (arg == "--batch") {
+        result.batch_mode = true;
+      } else if (!arg.starts_with("--")) {
+        result.batch.push_back(argv[i]);
+      } else {
+        throw fmt_runtime_error("Unknown argument {}", arg);
+      }
+    }
+    if (result.batch.size() > 1 && !result.batch_mode) {
+      throw fmt_runtime_error("Unknown argument {}", result.batch[1]);
+    }
+    if (!result.batch.empty()) {
+      result.input = result.batch[0];
+    }
+    // only the full-frame and batch paths lay the streams out in tiles
+    if (result.tile_size_arg.value_or(0) != 0) {
+      const char* mode = !result.rois.empty() ? "--roi"
+        : result.raw ? "--raw"
+        : result.out_of_core ? "--out-of-core"
+        : result.cache ? "--cache"
+        : !result.updates.empty() ? "--update"
+        : result.numa ? "--numa"
+        : !result.aovs.empty() ? "--aov"
+        : result.serve ? "--serve"
+        : nullptr;
+      if (mode) {
+        throw fmt_runtime_error("--tile does not apply to {}", mode);
+      }
+    }
+    if (result.patch && result.rois.empty()) {
+      throw std::runtime_error("--patch needs --roi");
+    }
+    if (!result.input && !result.serve && !result.autotune) {
+      throw std::runtime_error("No input image filename");
+    }
+    return result;
+  }
+
+  void apply(const filt::tuned_config& config) {
+    tile_size = tile_size_arg.value_or(config.tile_size);
+    params.exp = exp_arg.value_or(config.exp);
+    params.grain_rows = config.grain_rows;
+    // the tuned count is for one frame at a time; a batch sizes itself from the cpus it may use
+    threads = server.threads > 0 ? server.threads : batch_mode ? 0 : config.threads;
+    // numa_executor has neither tiles nor the aov pass
+    numa = numa || (config.numa && aovs.empty() && !tile_size_arg);
+    plan_placement = plan_placement || config.plan_placement;
+  }
+};
+
+// the configuration stored for this host, or the defaults when there is none or it cannot be
+// read, which goes to stderr since stdout may be carrying --raw output
+static filt::tuned_config load_config() {
+  try {
+    const std::string path = filt::tuned_config_path();
+    if (auto config = filt::load_tuned_config(path)) {
+      return *config;
+    }
+    log_out("No tuned configuration at {}, using defaults", path);
+  } catch (const std::exception& ex) {
+    fmt::println(stderr, "Using default configuration: {}", ex.what());
+  }
+  return {};
+}
+
+// tunes on the input, or a synthetic gbuffer without one, and stores the result for later runs
+// if it can; this run uses it either way
+static filt::tuned_config tune(const options& opts) {
+  fmt::println(stderr, "Tuning for this host");
+  auto gbuf = opts.input
+    ? filt::image(opts.input, filt::is_gbuffer_channel)
+    : filt::image::make_synthetic_gbuffer(1920, 1080);
+  auto config = filt::autotune(gbuf, [](const filt::tuned_config& c, double mps) {
+    fmt::println(
+      stderr,
+      "tile={} plan-placement={} exp={} grain={} threads={} numa={}\t{:.3f}",
+      c.tile_size, int(c.plan_placement), to_string(c.exp), c.grain_rows, c.threads, int(c.numa), mps);
+  });
+
+  try {
+    const std::string path = filt::tuned_config_path();
+    filt::save_tuned_config(path, config);
+    fmt::println(stderr, "Saved to {}", path);
+  } catch (const std::exception& ex) {
+    fmt::println(stderr, "Not saving the tuned configuration: {}", ex.what());
+  }
+  return config;
+}
+
+// decodes and filters only the requested regions, into the --patch output or a black frame
+static void run_roi(const options& opts) {
+  const auto frame = filt::exr_data_window(opts.input);
+  auto out_image = opts.patch
+    ? filt::image::load_png_rgb(opts.patch)
+    : filt::image::make_rgb(frame.width(), frame.height());
+  if (out_image.meta.width != frame.width() || out_image.meta.height != frame.height()) {
+    throw fmt_runtime_error(
+      "{} is {}×{}, but the frame is {}×{}",
+      opts.patch, out_image.meta.width, out_image.meta.height, frame.width(), frame.height());
+  }
+  auto pool = filt::memory_pool();
+
+  filt::roi_filter(opts.input, opts.rois, out_image, pool, opts.params);
+
+  out_image.dump_png_rgb(opts.patch ? opts.patch : "out/roi.png");
+}
+
+// stripe height of --raw without --stripe-rows
+constexpr int raw_stripe_rows = 64;
+
+// Streams the filtered frame out row by row as the stripes finish, see raw_writer. Nothing else
+// is written: no input dump and no timing, since stdout may be the data.
+static void run_raw(const options& opts) {
+  const auto frame = filt::exr_data_window(opts.input);
+  auto pool = filt::memory_pool();
+  filt::raw_writer out(opts.raw, opts.raw_format, frame.width(), frame.height());
+
+  // the tallest stripe that fits the pool is usually the whole frame, and nothing would reach the
+  // reader before the filter is done
+  const int stripe_rows = opts.stripe_rows > 0 ? opts.stripe_rows : raw_stripe_rows;
+  filt::stripe_filter(
+    opts.input, pool, stripe_rows,
+    [&](int, std::span<const float>, std::span<const float> filtered) {
+      out.write_row(filtered);
+    },
+    opts.params, out.order());
+  out.close();
+}
+
+// never holds more than one stripe: input and output pngs are written as the rows come out
+static void run_out_of_core(const options& opts) {
+  const auto frame = filt::exr_data_window(opts.input);
+  auto pool = filt::memory_pool();
+
+  png_writer in_png("out/in.png");
+  png_writer out_png("out/out.png");
+  in_png.begin(frame.width(), frame.height(), PNG_COLOR_TYPE_RGB);
+  out_png.begin(frame.width(), frame.height(), PNG_COLOR_TYPE_RGB);
+  std::vector<unsigned char> row(3 * frame.width());
+  auto write_row = [&](png_writer& png, std::span<const float> values) {
+    std::ranges::transform(values, row.begin(), clamp_float_value);
+    png.write_row(row.data());
+  };
+
+  auto timer = interval_timer();
+  filt::stripe_filter(
+    opts.input, pool, opts.stripe_rows,
+    [&](int, std::span<const float> color, std::span<const float> filtered) {
+      write_row(in_png, color);
+      write_row(out_png, filtered);
+    },
+    opts.params);
+  filt::image_meta frame_meta;
+  frame_meta.width = frame.width();
+  frame_meta.height = frame.height();
+  timer.report(frame_meta);
+
+  std::move(in_png).end();
+  std::move(out_png).end();
+}
+
+static void dump_in_out_pngs(const filt::image_meta& meta, const filt::filter_streams& streams) {
+  auto in_image = filt::image::make_rgb(meta.width, meta.height);
+  auto out_image = filt::image::make_rgb(meta.width, meta.height);
+
+  deinterleave3(in_image.data, streams.color);
+  deinterleave3(out_image.data, streams.dst);
+
+  in_image.dump_png_rgb("out/in.png");
+  out_image.dump_png_rgb("out/out.png");
+}
+
+// the first run decodes the exr and writes the cache, later ones filter straight from the mapping
+static void run_cached(const options& opts) {
+  auto cache = filt::gbuffer_cache::open(opts.cache, opts.input);
+  if (!cache) {
+    auto gbuf = filt::image(opts.input, filt::is_gbuffer_channel);
+    auto pool = filt::memory_pool(filt::memory_pool::gbuffer_size_bytes(gbuf.meta.total_pixels()));
+    auto streams = pool.upload_gbuffer(gbuf);
+    filt::gbuffer_cache::write(opts.cache, opts.input, gbuf.meta, streams);
+    cache = filt::gbuffer_cache::open(opts.cache, opts.input);
+    assert_release(cache);
+  }
+
+  // with --plan-placement, place the scratch streams around the mapped inputs, which sit wherever
+  // the file has them
+  auto page_offset = [](std::span<const float> s) {
+    return ptrdiff_t(reinterpret_cast<uintptr_t>(s.data()) % 4096);
+  };
+  const ptrdiff_t row = 3 * ptrdiff_t(sizeof(float)) * cache->meta.width;
+  const int guide_rows = 2 * filt::filter_radius + 1;
+  const filt::stream_access accesses[5] = {
+    {.rows = 1, .row_stride_bytes = row, .fixed_offset = page_offset(cache->color)},
+    {.rows = 1, .row_stride_bytes = row, .fixed_offset = page_offset(cache->albedo)},
+    {.rows = guide_rows, .row_stride_bytes = row, .fixed_offset = page_offset(cache->normals)},
+    {.rows = 1, .row_stride_bytes = row},
+    {.rows = guide_rows, .row_stride_bytes = row},
+  };
+  const filt::gbuffer_placement hand_picked;
+  const auto offsets = opts.plan_placement
+    ? filt::memory_pool::plan_offsets(accesses)
+    : std::vector<ptrdiff_t>{0, 0, 0, hand_picked.dst, hand_picked.z};
+
+  const ptrdiff_t stream_elems = 3 * cache->meta.total_pixels();
+  auto pool = filt::memory_pool(filt::memory_pool::gbuffer_size_bytes(cache->meta.total_pixels()));
+  auto streams = filt::filter_streams{
+    .dst = pool.allocate<float>(offsets[3], stream_elems),
+    .color = cache->color,
+    .albedo = cache->albedo,
+    .normals = cache->normals,
+    .z = pool.allocate<float>(offsets[4], stream_elems),
+  };
 
-#if 0
   {
     auto timer = interval_timer();
-    auto result = filt::naive_filter(gbuf);
+    filt::linear_filter(cache->meta, streams, opts.params);
+    timer.report(cache->meta);
+  }
+
+  dump_in_out_pngs(cache->meta, streams);
+}
+
+// one pinned arena and node-local pool per NUMA node, each filtering its own band
+static void run_numa(const options& opts) {
+  auto gbuf = filt::image(opts.input, filt::is_gbuffer_channel);
+  auto executor = filt::numa_executor();
+  std::vector<float> dst(3 * gbuf.meta.total_pixels());
+
+  {
+    auto timer = interval_timer();
+    executor.filter(gbuf, dst, opts.params);
     timer.report(gbuf.meta);
-    // result.dump_png_rgb("out/naive.png");
-    return 0;
   }
-#endif
 
-  filt::linear_channel color_channels[3] = {
-    gbuf.meta.find_channel("R"),
-    gbuf.meta.find_channel("G"),
-    gbuf.meta.find_channel("B"),
-  };
-  filt::linear_channel albedo_channels[3] = {
-    gbuf.meta.find_channel("Albedo.R"),
-    gbuf.meta.find_channel("Albedo.G"),
-    gbuf.meta.find_channel("Albedo.B"),
+  gbuf.dump_png_rgb("out/in.png");
+  filt::dump_png_rgb_interleaved("out/out.png", gbuf.meta.width, gbuf.meta.height, dst);
+}
+
+// the input, then every --update frame in turn, re-filtering only the tiles that changed
+static void run_incremental(const options& opts) {
+  const auto frame = filt::exr_data_window(opts.input);
+  filt::incremental_filter filter(frame.width(), frame.height(), opts.params);
+
+  auto update = [&](const char* path) {
+    auto gbuf = filt::image(path, filt::is_gbuffer_channel);
+    auto timer = interval_timer();
+    const int changed = filter.update(gbuf);
+    fmt::println(
+      "{}\t{}/{} tiles\t{:.3f} ms",
+      path, changed, filter.tile_count(), timer.elapsed().count() * 1e-3);
   };
-  filt::linear_channel normal_channels[3] = {
-    gbuf.meta.find_channel("Ns.X"),
-    gbuf.meta.find_channel("Ns.Y"),
-    gbuf.meta.find_channel("Ns.Z"),
+  update(opts.input);
+  for (const char* path: opts.updates) {
+    update(path);
+  }
+
+  filt::dump_png_rgb_interleaved("out/out.png", frame.width(), frame.height(), filter.output());
+}
+
+// all inputs several at a time, each written to out/<index>.png
+static void run_batch(const options& opts) {
+  filt::batch_options batch_opts;
+  batch_opts.threads = opts.threads;
+  batch_opts.tile_size = opts.tile_size;
+  batch_opts.params = opts.params;
+
+  auto timer = interval_timer();
+  const auto layout = filt::filter_batch(
+    opts.batch,
+    [](int index, const filt::image& gbuf, std::span<const float> filtered) {
+      filt::dump_png_rgb_interleaved(
+        fmt::format("out/{}.png", index).c_str(), gbuf.meta.width, gbuf.meta.height, filtered);
+    },
+    batch_opts);
+  const double seconds = timer.elapsed().count() * 1e-6;
+  fmt::println(
+    "{} frames, {} at a time with {} threads each\t{:.3f} frames/s",
+    opts.batch.size(), layout.concurrent_frames, layout.threads_per_frame, opts.batch.size() / seconds);
+}
+
+// every --aov in one pass over shared edge-stopping weights, written to out/aov<i>
+static void run_aovs(const options& opts) {
+  auto gbuf = filt::image(opts.input);
+  const ptrdiff_t pixels = gbuf.meta.total_pixels();
+
+  auto find_channels = [&](const auto& names) {
+    std::vector<filt::linear_channel> found;
+    for (const auto& name: names) {
+      found.push_back(gbuf.meta.find_channel(name));
+    }
+    return found;
   };
 
-  auto pool = filt::memory_pool();
+  ptrdiff_t pool_floats = 6 * pixels;
+  for (const auto& aov: opts.aovs) {
+    pool_floats += (aov.demodulate ? 3 : 2) * std::ssize(aov.channels) * pixels;
+  }
+  const ptrdiff_t pool_streams = 2 + 3 * std::ssize(opts.aovs);
+  auto pool = filt::memory_pool(pool_floats * ptrdiff_t(sizeof(float)) + 2 * 4096 * pool_streams);
 
-  auto color_mem = pool.upload_channels_interleave(0, gbuf, color_channels);
-  auto albedo_mem = pool.upload_channels_interleave(0, gbuf, albedo_channels);
-  auto normal_mem = pool.upload_channels_interleave(128, gbuf, normal_channels);
+  const bool any_demodulated = std::ranges::any_of(opts.aovs, &aov_option::demodulate);
+  auto normals = pool.upload_channels_interleave(
+    128, gbuf, find_channels(std::array{"Ns.X", "Ns.Y", "Ns.Z"}));
+  auto albedo = any_demodulated
+    ? pool.upload_channels_interleave(0, gbuf, find_channels(std::array{"Albedo.R", "Albedo.G", "Albedo.B"}))
+    : std::span<float>();
 
-  auto dst_mem = pool.allocate<float>(192, 3 * gbuf.meta.total_pixels());
-  auto z_mem = pool.allocate<float>(0, 3 * gbuf.meta.total_pixels());
+  std::vector<filt::aov_target> targets;
+  for (const auto& aov: opts.aovs) {
+    const int channels = std::ssize(aov.channels);
+    targets.push_back(filt::aov_target{
+      .color = pool.upload_channels_interleave(0, gbuf, find_channels(aov.channels)),
+      .dst = pool.allocate<float>(192, channels * pixels),
+      .channels = channels,
+      .demodulate = aov.demodulate,
+      .z = aov.demodulate ? pool.allocate<float>(0, channels * pixels) : std::span<float>(),
+    });
+  }
 
-  auto in_image = filt::image::make_rgb(gbuf.meta.width, gbuf.meta.height);
-  auto out_image = filt::image::make_rgb(gbuf.meta.width, gbuf.meta.height);
+  {
+    auto timer = interval_timer();
+    filt::linear_filter_multi(gbuf.meta, albedo, normals, targets, opts.params);
+    timer.report(gbuf.meta);
+  }
 
-  // for (int i = 0; i < 10; ++i)
+  for (int i = 0; i < std::ssize(targets); ++i) {
+    const auto& target = targets[i];
+    if (target.channels == 3) {
+      filt::dump_png_rgb_interleaved(
+        fmt::format("out/aov{}.png", i).c_str(), gbuf.meta.width, gbuf.meta.height, target.dst);
+      continue;
+    }
+
+    filt::image_meta meta;
+    meta.width = gbuf.meta.width;
+    meta.height = gbuf.meta.height;
+    for (int c = 0; c < target.channels; ++c) {
+      meta.channels.push_back(filt::linear_channel{
+        .name = opts.aovs[i].channels[c],
+        .elem_width_bytes = sizeof(float),
+        .base_offset_bytes = c * pixels * ptrdiff_t(sizeof(float)),
+        .stride_x_bytes = sizeof(float),
+        .stride_y_bytes = meta.width * ptrdiff_t(sizeof(float)),
+      });
+    }
+    auto planar = filt::image(std::move(meta));
+    deinterleave(planar.data, target.dst, target.channels);
+    planar.dump_pngs_prefix(fmt::format("out/aov{}.", i));
+  }
+}
+
+int main(int argc, char** argv) try {
+  auto opts = options::parse(argc, argv);
+
+  if (opts.serve) {
+    filt::serve(opts.serve, opts.server);
+  }
+
+  opts.apply(opts.autotune ? tune(opts) : load_config());
+  if (!opts.input) {
+    return 0;
+  }
+  std::optional<tbb::global_control> thread_limit;
+  if (opts.threads > 0) {
+    thread_limit.emplace(tbb::global_control::max_allowed_parallelism, opts.threads);
+  }
+  if (!opts.rois.empty()) {
+    run_roi(opts);
+    return 0;
+  }
+  if (opts.raw) {
+    run_raw(opts);
+    return 0;
+  }
+  if (opts.out_of_core) {
+    run_out_of_core(opts);
+    return 0;
+  }
+  if (opts.cache) {
+    run_cached(opts);
+    return 0;
+  }
+  if (opts.batch_mode) {
+    run_batch(opts);
+    return 0;
+  }
+  if (!opts.updates.empty()) {
+    run_incremental(opts);
+    return 0;
+  }
+  if (opts.numa) {
+    run_numa(opts);
+    return 0;
+  }
+  if (!opts.aovs.empty()) {
+    run_aovs(opts);
+    return 0;
+  }
+
+  auto gbuf = filt::image(opts.input);
+
+#if 0
   {
     auto timer = interval_timer();
-    filt::linear_filter(gbuf.meta, filt::filter_streams{
-      .dst = dst_mem,
-      .color = color_mem,
-      .albedo = albedo_mem,
-      .normals = normal_mem,
-      .z = z_mem,
-    });
+    auto result = filt::naive_filter(gbuf);
     timer.report(gbuf.meta);
+    // result.dump_png_rgb("out/naive.png");
+    return 0;
   }
+#endif
 
-  deinterleave3(in_image.data, color_mem);
-  deinterleave3(out_image.data, dst_mem);
+  auto pool = filt::memory_pool(std::max(
+    filt::memory_pool::default_size,
+    filt::memory_pool::gbuffer_size_bytes(
+      filt::tiled_pixel_count(gbuf.meta.width, gbuf.meta.height, opts.tile_size))));
+  auto streams = pool.upload_gbuffer(
+    gbuf, 0, gbuf.meta.height, opts.tile_size,
+    opts.plan_placement
+      ? filt::memory_pool::plan_gbuffer(gbuf.meta.width, opts.tile_size)
+      : filt::gbuffer_placement{});
 
-  in_image.dump_png_rgb("out/in.png");
-  out_image.dump_png_rgb("out/out.png");
+  // for (int i = 0; i < 10; ++i)
+  {
+    auto timer = interval_timer();
+    filt::linear_filter(gbuf.meta, streams, opts.params);
+    timer.report(gbuf.meta);
+  }
+
+  dump_in_out_pngs(gbuf.meta, streams);
 
 } catch (const std::exception& ex) {
   fmt::print(
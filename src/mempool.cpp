@@ -1,12 +1,19 @@
 #include "mempool.hpp"
+#include <algorithm>
+#include <filesystem>
 #include <fmt/ranges.h>
+#include <fstream>
+#include <functional>
+#include <limits>
 #include <ranges>
+#include <string>
+#include <utility>
 #include <sys/mman.h>
 
 namespace filt {
 
-memory_pool::memory_pool() {
-  constexpr ptrdiff_t memory_size = 500 * 1024 * 1024;
+memory_pool::memory_pool(ptrdiff_t memory_size) {
+  memory_size = (memory_size + 4095) / 4096 * 4096;
   void* mapped = ::mmap(
     nullptr,
     memory_size,
@@ -45,11 +52,11 @@ static void assert_valid_channel(const image_meta& meta, const linear_channel& c
 }
 
 std::span<float> memory_pool::upload_channel(
-  int alloc_offset,
+  ptrdiff_t alloc_offset,
   const image& image,
   const linear_channel& channel
 ) {
-  int total_pixels = image.meta.total_pixels();
+  ptrdiff_t total_pixels = image.meta.total_pixels();
   auto alloc = allocate<float>(alloc_offset, total_pixels);
 
   assert_valid_channel(image.meta, channel);
@@ -63,22 +70,51 @@ std::span<float> memory_pool::upload_channel(
 }
 
 std::span<float> memory_pool::upload_channels_interleave(
-  int alloc_offset,
+  ptrdiff_t alloc_offset,
   const image& image,
   std::span<const linear_channel> channels
 ) {
-  int channel_pixels = image.meta.total_pixels();
-  int total_pixels = channel_pixels * std::ssize(channels);
+  return upload_channels_interleave(alloc_offset, image, channels, 0, image.meta.height);
+}
+
+static void assert_valid_region(const image_meta& meta, const rect& region) {
+  assert_release(0 <= region.x0 && region.x0 <= region.x1 && region.x1 <= meta.width);
+  assert_release(0 <= region.y0 && region.y0 <= region.y1 && region.y1 <= meta.height);
+}
+
+std::span<float> memory_pool::upload_channels_interleave(
+  ptrdiff_t alloc_offset,
+  const image& image,
+  std::span<const linear_channel> channels,
+  int row_begin,
+  int row_end
+) {
+  return upload_channels_interleave(
+    alloc_offset, image, channels, rect{0, row_begin, image.meta.width, row_end});
+}
+
+std::span<float> memory_pool::upload_channels_interleave(
+  ptrdiff_t alloc_offset,
+  const image& image,
+  std::span<const linear_channel> channels,
+  const rect& region
+) {
+  assert_valid_region(image.meta, region);
+  ptrdiff_t channel_pixels = ptrdiff_t(region.width()) * region.height();
+  ptrdiff_t total_pixels = channel_pixels * std::ssize(channels);
   auto alloc = allocate<float>(alloc_offset, total_pixels);
 
   for (auto& channel: channels) {
     assert_valid_channel(image.meta, channel);
   }
 
-  int offset = 0;
-  for (int i = 0; i < channel_pixels; ++i) {
-    for (auto& channel: channels) {
-      alloc[offset++] = image.data[channel.base_offset_elems() + i];
+  ptrdiff_t offset = 0;
+  for (int y = region.y0; y < region.y1; ++y) {
+    const ptrdiff_t row = ptrdiff_t(y) * image.meta.width;
+    for (ptrdiff_t i = row + region.x0; i < row + region.x1; ++i) {
+      for (auto& channel: channels) {
+        alloc[offset++] = image.data[channel.base_offset_elems() + i];
+      }
     }
   }
   assert_release(offset == total_pixels);
@@ -90,4 +126,257 @@ std::span<float> memory_pool::upload_channels_interleave(
   return alloc;
 }
 
+std::span<float> memory_pool::upload_channels_tiled(
+  ptrdiff_t alloc_offset,
+  const image& image,
+  std::span<const linear_channel> channels,
+  int row_begin,
+  int row_end,
+  int tile_size
+) {
+  return upload_channels_tiled(
+    alloc_offset, image, channels, rect{0, row_begin, image.meta.width, row_end}, tile_size);
+}
+
+std::span<float> memory_pool::upload_channels_tiled(
+  ptrdiff_t alloc_offset,
+  const image& image,
+  std::span<const linear_channel> channels,
+  const rect& region,
+  int tile_size
+) {
+  assert_valid_region(image.meta, region);
+  const int width = region.width();
+  const int height = region.height();
+  const ptrdiff_t nchannels = std::ssize(channels);
+  auto alloc = allocate<float>(alloc_offset, nchannels * tiled_pixel_count(width, height, tile_size));
+  std::ranges::fill(alloc, 0.f);
+
+  for (auto& channel: channels) {
+    assert_valid_channel(image.meta, channel);
+  }
+
+  for (int y = 0; y < height; ++y) {
+    const ptrdiff_t row = ptrdiff_t(region.y0 + y) * image.meta.width + region.x0;
+    for (int x = 0; x < width; ++x) {
+      const ptrdiff_t at = nchannels * tiled_pixel_index(width, tile_size, x, y);
+      for (ptrdiff_t c = 0; c < nchannels; ++c) {
+        alloc[at + c] = image.data[channels[c].base_offset_elems() + row + x];
+      }
+    }
+  }
+
+  log_out("Tiled {} channels @ {} in {}×{} tiles", nchannels, fmt::ptr(alloc.data()), tile_size, tile_size);
+  return alloc;
+}
+
+filter_streams memory_pool::upload_gbuffer(const image& gbuf) {
+  return upload_gbuffer(gbuf, 0, gbuf.meta.height);
+}
+
+filter_streams memory_pool::upload_gbuffer(
+  const image& gbuf,
+  int row_begin,
+  int row_end,
+  int tile_size
+) {
+  return upload_gbuffer(gbuf, row_begin, row_end, tile_size, gbuffer_placement{});
+}
+
+filter_streams memory_pool::upload_gbuffer(
+  const image& gbuf,
+  int row_begin,
+  int row_end,
+  int tile_size,
+  const gbuffer_placement& placement
+) {
+  return upload_gbuffer(gbuf, rect{0, row_begin, gbuf.meta.width, row_end}, tile_size, placement);
+}
+
+filter_streams memory_pool::upload_gbuffer(
+  const image& gbuf,
+  const rect& region,
+  int tile_size,
+  const gbuffer_placement& placement
+) {
+  const linear_channel color_channels[3] = {
+    gbuf.meta.find_channel("R"),
+    gbuf.meta.find_channel("G"),
+    gbuf.meta.find_channel("B"),
+  };
+  const linear_channel albedo_channels[3] = {
+    gbuf.meta.find_channel("Albedo.R"),
+    gbuf.meta.find_channel("Albedo.G"),
+    gbuf.meta.find_channel("Albedo.B"),
+  };
+  const linear_channel normal_channels[3] = {
+    gbuf.meta.find_channel("Ns.X"),
+    gbuf.meta.find_channel("Ns.Y"),
+    gbuf.meta.find_channel("Ns.Z"),
+  };
+
+  auto color_mem = upload_channels_interleave(placement.color, gbuf, color_channels, region);
+  auto albedo_mem = upload_channels_interleave(placement.albedo, gbuf, albedo_channels, region);
+  auto normal_mem = tile_size == 0
+    ? upload_channels_interleave(placement.normals, gbuf, normal_channels, region)
+    : upload_channels_tiled(placement.normals, gbuf, normal_channels, region, tile_size);
+
+  const ptrdiff_t stream_elems = 3 * ptrdiff_t(region.width()) * region.height();
+  const ptrdiff_t guide_elems = 3 * tiled_pixel_count(region.width(), region.height(), tile_size);
+  auto dst_mem = allocate<float>(placement.dst, stream_elems);
+  auto z_mem = allocate<float>(placement.z, guide_elems);
+
+  return filter_streams{
+    .dst = dst_mem,
+    .color = color_mem,
+    .albedo = albedo_mem,
+    .normals = normal_mem,
+    .z = z_mem,
+    .tile_size = tile_size,
+  };
+}
+
+std::span<const cache_level> cache_geometry() {
+  static const std::vector<cache_level> levels = [] {
+    namespace fs = std::filesystem;
+    auto read_int = [](const fs::path& path) {
+      int value = 0;
+      std::ifstream(path) >> value;
+      return value;
+    };
+
+    std::vector<cache_level> result;
+    std::error_code ec;
+    for (const auto& entry: fs::directory_iterator("/sys/devices/system/cpu/cpu0/cache", ec)) {
+      if (!entry.path().filename().string().starts_with("index")) {
+        continue;
+      }
+      std::string type;
+      std::ifstream(entry.path() / "type") >> type;
+      const cache_level level{
+        .level = read_int(entry.path() / "level"),
+        .line_size = read_int(entry.path() / "coherency_line_size"),
+        .sets = read_int(entry.path() / "number_of_sets"),
+        .ways = read_int(entry.path() / "ways_of_associativity"),
+      };
+      if (type != "Instruction" && level.line_size > 0 && level.sets > 0 && level.ways > 0) {
+        result.push_back(level);
+      }
+    }
+    if (result.empty()) {
+      result.push_back(cache_level{.level = 1, .line_size = 64, .sets = 64, .ways = 8});
+    }
+    std::ranges::sort(result, {}, &cache_level::level);
+    return result;
+  }();
+  return levels;
+}
+
+std::vector<ptrdiff_t> memory_pool::plan_offsets(
+  std::span<const stream_access> streams,
+  std::span<const cache_level> caches
+) {
+  constexpr ptrdiff_t page = 4096;
+
+  // per level, the lines touched at one pixel in each set index slot the page offset determines
+  struct level_slots {
+    ptrdiff_t span;
+    ptrdiff_t line;
+    int capacity;
+    std::vector<int> count;
+  };
+  std::vector<level_slots> levels;
+  ptrdiff_t step = page;
+  for (const cache_level& cache: caches) {
+    const ptrdiff_t set_span = ptrdiff_t(cache.sets) * cache.line_size;
+    const ptrdiff_t span = std::min(set_span, page);
+    levels.push_back(level_slots{
+      .span = span,
+      .line = cache.line_size,
+      .capacity = cache.ways * int(std::max<ptrdiff_t>(1, set_span / page)),
+      .count = std::vector<int>(span / cache.line_size),
+    });
+    step = std::min<ptrdiff_t>(step, cache.line_size);
+  }
+
+  auto touch = [&](const stream_access& stream, ptrdiff_t offset, int delta) {
+    for (int r = -(stream.rows / 2); r < stream.rows - stream.rows / 2; ++r) {
+      const ptrdiff_t at = offset + r * stream.row_stride_bytes;
+      for (level_slots& level: levels) {
+        const ptrdiff_t in_span = (at % level.span + level.span) % level.span;
+        level.count[in_span / level.line] += delta;
+      }
+    }
+  };
+  // lines beyond what a set holds first, then how evenly the rest is spread
+  auto cost = [&] {
+    ptrdiff_t excess = 0;
+    ptrdiff_t spread = 0;
+    for (const level_slots& level: levels) {
+      for (int n: level.count) {
+        excess += std::max(0, n - level.capacity);
+        spread += n * n;
+      }
+    }
+    return std::pair(excess, spread);
+  };
+
+  std::vector<ptrdiff_t> result(streams.size());
+  std::vector<int> order;
+  for (int i = 0; i < std::ssize(streams); ++i) {
+    if (streams[i].fixed_offset) {
+      result[i] = *streams[i].fixed_offset;
+      touch(streams[i], result[i], +1);
+    } else {
+      order.push_back(i);
+    }
+  }
+  // the streams touching the most rows have the fewest good spots, so they go first
+  std::ranges::stable_sort(order, std::greater{}, [&](int i) { return streams[i].rows; });
+
+  for (int i: order) {
+    ptrdiff_t best_offset = 0;
+    auto best_cost = std::pair(std::numeric_limits<ptrdiff_t>::max(), ptrdiff_t(0));
+    for (ptrdiff_t offset = 0; offset < page; offset += step) {
+      touch(streams[i], offset, +1);
+      if (auto c = cost(); c < best_cost) {
+        best_cost = c;
+        best_offset = offset;
+      }
+      touch(streams[i], offset, -1);
+    }
+    result[i] = best_offset;
+    touch(streams[i], best_offset, +1);
+  }
+  return result;
+}
+
+gbuffer_placement memory_pool::plan_gbuffer(int width, int tile_size) {
+  // the kernel reads color, albedo and dst at the current pixel only, normals and z over the
+  // whole neighbourhood; a tiled guide steps rows within a tile
+  const ptrdiff_t row = 3 * ptrdiff_t(sizeof(float)) * width;
+  const ptrdiff_t guide_row = tile_size == 0 ? row : 3 * ptrdiff_t(sizeof(float)) * tile_size;
+  const stream_access streams[5] = {
+    {.rows = 1, .row_stride_bytes = row},
+    {.rows = 1, .row_stride_bytes = row},
+    {.rows = 2 * filter_radius + 1, .row_stride_bytes = guide_row},
+    {.rows = 1, .row_stride_bytes = row},
+    {.rows = 2 * filter_radius + 1, .row_stride_bytes = guide_row},
+  };
+  const auto offsets = plan_offsets(streams);
+  return gbuffer_placement{
+    .color = offsets[0],
+    .albedo = offsets[1],
+    .normals = offsets[2],
+    .dst = offsets[3],
+    .z = offsets[4],
+  };
+}
+
+ptrdiff_t memory_pool::gbuffer_size_bytes(ptrdiff_t total_pixels) {
+  // five 3-channel streams, each rounded to pages with at most one extra page of offset
+  const ptrdiff_t stream_pages = (3 * total_pixels * ptrdiff_t(sizeof(float)) + 4095) / 4096 + 1;
+  return 5 * stream_pages * 4096;
+}
+
 }  // namespace filt
\ No newline at end of file
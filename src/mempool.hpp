@@ -1,28 +1,67 @@
 #pragma once
 #include "image.hpp"
 #include "util.hpp"
+#include <optional>
 #include <span>
 #include <stdexcept>
+#include <vector>
 
 namespace filt {
 
+// a data or unified cache of cpu0, from /sys/devices/system/cpu/cpu0/cache
+struct cache_level {
+  int level;
+  int line_size;
+  int sets;
+  int ways;
+};
+
+// read once; a 32 KiB 8-way L1 with 64-byte lines where sysfs has nothing
+std::span<const cache_level> cache_geometry();
+
+// One of several streams a kernel walks at the same pixel index and the same bytes per pixel,
+// touching `rows` rows centered on the current one.
+struct stream_access {
+  int rows = 1;
+  ptrdiff_t row_stride_bytes = 0;
+  // offset from page alignment of a stream placed elsewhere, e.g. in a mapped file
+  std::optional<ptrdiff_t> fixed_offset = std::nullopt;
+};
+
+// allocation offsets of the upload_gbuffer streams: hand-picked defaults, or plan_gbuffer's, opt-in
+struct gbuffer_placement {
+  ptrdiff_t color = 0;
+  ptrdiff_t albedo = 0;
+  ptrdiff_t normals = 128;
+  ptrdiff_t dst = 192;
+  ptrdiff_t z = 0;
+};
+
 struct memory_pool: nonmovable {
   std::span<std::byte> memory;
   ptrdiff_t top = 0;
 
-  explicit memory_pool();
+  static constexpr ptrdiff_t default_size = 500 * 1024 * 1024;
+
+  explicit memory_pool(ptrdiff_t size_bytes = default_size);
   ~memory_pool();
 
   void prefault_memory();
 
+  // frees everything allocated after `mark` was read from `top`
+  void release_to(ptrdiff_t mark) {
+    assert_release(mark <= top && mark % 4096 == 0);
+    top = mark;
+  }
+
   template<typename T>
-  [[nodiscard]] std::span<T> allocate(int offset_bytes, int size_elems) {
+  [[nodiscard]] std::span<T> allocate(ptrdiff_t offset_bytes, ptrdiff_t size_elems) {
 #if 0
     offset_bytes = 0;
 #endif
     assert_release(offset_bytes % sizeof(T) == 0);
-    int size_bytes = size_elems * sizeof(T);
-    int size_pages = (size_elems * sizeof(T) + offset_bytes + 4095) / 4096;
+    ptrdiff_t size_bytes = size_elems * ptrdiff_t(sizeof(T));
+    ptrdiff_t size_pages = (size_bytes + offset_bytes + 4095) / 4096;
 
     size_bytes = size_pages * 4096;
     assert_release(offset_bytes <= size_bytes);
@@ -39,14 +78,82 @@ struct memory_pool: nonmovable {
   }
 
   [[nodiscard]] std::span<float> upload_channel(
-    int offset,
+    ptrdiff_t offset,
     const image& image,
     const linear_channel& channel);
 
   [[nodiscard]] std::span<float> upload_channels_interleave(
-    int offset,
+    ptrdiff_t offset,
     const image& image,
     std::span<const linear_channel> channels);
+
+  // rows [row_begin, row_end) only
+  [[nodiscard]] std::span<float> upload_channels_interleave(
+    ptrdiff_t offset,
+    const image& image,
+    std::span<const linear_channel> channels,
+    int row_begin,
+    int row_end);
+
+  // the pixels of `region` only, in image coordinates; the stream is region.width() wide
+  [[nodiscard]] std::span<float> upload_channels_interleave(
+    ptrdiff_t offset,
+    const image& image,
+    std::span<const linear_channel> channels,
+    const rect& region);
+
+  // rows [row_begin, row_end) interleaved in the tiled layout of tiled_pixel_index, padding zeroed
+  [[nodiscard]] std::span<float> upload_channels_tiled(
+    ptrdiff_t offset,
+    const image& image,
+    std::span<const linear_channel> channels,
+    int row_begin,
+    int row_end,
+    int tile_size);
+
+  [[nodiscard]] std::span<float> upload_channels_tiled(
+    ptrdiff_t offset,
+    const image& image,
+    std::span<const linear_channel> channels,
+    const rect& region,
+    int tile_size);
+
+  // interleaved color, albedo and normal streams of a gbuffer image plus dst and z scratch
+  [[nodiscard]] filter_streams upload_gbuffer(const image& gbuffer);
+
+  // rows [row_begin, row_end) only, normals and z tiled when tile_size is nonzero
+  [[nodiscard]] filter_streams upload_gbuffer(
+    const image& gbuffer,
+    int row_begin,
+    int row_end,
+    int tile_size = 0);
+
+  // the same at explicit offsets, e.g. those of plan_gbuffer
+  [[nodiscard]] filter_streams upload_gbuffer(
+    const image& gbuffer,
+    int row_begin,
+    int row_end,
+    int tile_size,
+    const gbuffer_placement& placement);
+
+  // region.width() wide streams of `region` (image coordinates) only
+  [[nodiscard]] filter_streams upload_gbuffer(
+    const image& gbuffer,
+    const rect& region,
+    int tile_size = 0,
+    const gbuffer_placement& placement = {});
+
+  // an offset below one page per stream, spreading the lines touched at one pixel over the cache sets
+  // as far as the page offset decides them
+  static std::vector<ptrdiff_t> plan_offsets(
+    std::span<const stream_access> streams,
+    std::span<const cache_level> caches = cache_geometry());
+
+  // plan_offsets for the linear_filter streams of a frame `width` pixels wide
+  static gbuffer_placement plan_gbuffer(int width, int tile_size = 0);
+
+  // pool space upload_gbuffer takes for an image of this many pixels
+  static ptrdiff_t gbuffer_size_bytes(ptrdiff_t total_pixels);
 };
 
 }  // namespace filt
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "numa.hpp"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <oneapi/tbb/task_arena.h>
+#include <oneapi/tbb/task_group.h>
+#include <oneapi/tbb/task_scheduler_observer.h>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace filt {
+
+namespace {
+
+// "0-7,16-23"
+std::vector<int> parse_cpulist(std::string_view text) {
+  std::vector<int> cpus;
+  const char* at = text.data();
+  const char* end = text.data() + text.size();
+  while (at < end) {
+    int first;
+    auto [next, ec] = std::from_chars(at, end, first);
+    if (ec != std::errc()) {
+      break;
+    }
+    int last = first;
+    if (next < end && *next == '-') {
+      auto range_end = std::from_chars(next + 1, end, last);
+      if (range_end.ec != std::errc()) {
+        break;
+      }
+      next = range_end.ptr;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+    at = next + 1;
+  }
+  return cpus;
+}
+
+// pins threads joining the arena to the node's cpus, restoring an external thread's mask on leave
+class node_pinning: public tbb::task_scheduler_observer {
+  std::vector<int> cpus;
+  std::vector<int> external_cpus;
+  std::atomic<bool> warned = false;
+
+  // an unpinned thread still computes the right result, so a failure only warns, once
+  void pin(std::span<const int> to) noexcept {
+    try {
+      set_affinity(to);
+    } catch (const std::exception& ex) {
+      if (!warned.exchange(true)) {
+        fmt::println(stderr, "Running NUMA workers unpinned: {}", ex.what());
+      }
+    }
+  }
+
+public:
+  node_pinning(tbb::task_arena& arena, std::vector<int> node_cpus):
+    tbb::task_scheduler_observer(arena),
+    cpus(std::move(node_cpus)),
+    external_cpus(get_affinity())
+  {
+    observe(true);
+  }
+
+  ~node_pinning() {
+    observe(false);
+  }
+
+  void on_scheduler_entry(bool) override {
+    pin(cpus);
+  }
+
+  void on_scheduler_exit(bool is_worker) override {
+    if (!is_worker) {
+      pin(external_cpus);
+    }
+  }
+};
+
+}  // namespace
+
+std::vector<numa_node> numa_topology() {
+  const std::vector<int> allowed = get_affinity();
+  std::vector<numa_node> nodes;
+
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  for (const auto& entry: fs::directory_iterator("/sys/devices/system/node", ec)) {
+    const std::string name = entry.path().filename();
+    if (!name.starts_with("node")) {
+      continue;
+    }
+    int id;
+    auto [end, parse_ec] = std::from_chars(name.data() + 4, name.data() + name.size(), id);
+    if (parse_ec != std::errc() || end != name.data() + name.size()) {
+      continue;
+    }
+
+    std::string cpulist;
+    std::getline(std::ifstream(entry.path() / "cpulist"), cpulist);
+    auto cpus = parse_cpulist(cpulist);
+    std::erase_if(cpus, [&](int cpu) { return !std::ranges::binary_search(allowed, cpu); });
+    if (!cpus.empty()) {
+      nodes.push_back(numa_node{.id = id, .cpus = std::move(cpus)});
+    }
+  }
+
+  if (nodes.empty()) {
+    nodes.push_back(numa_node{.id = 0, .cpus = allowed});
+  }
+  std::ranges::sort(nodes, {}, &numa_node::id);
+  return nodes;
+}
+
+struct numa_executor::node_context: nonmovable {
+  numa_node node;
+  tbb::task_arena arena;
+  node_pinning pinning;
+  tbb::task_group group;
+  std::optional<memory_pool> pool;
+
+  explicit node_context(numa_node n):
+    node(std::move(n)),
+    // no slot kept for the caller, which only submits through group.run and joins later
+    arena(int(std::ssize(node.cpus)), 0),
+    pinning(arena, node.cpus)
+  {}
+
+  // runs inside the arena, so the pages land on this node
+  void reserve_pool(ptrdiff_t size_bytes) {
+    if (!pool || std::ssize(pool->memory) < size_bytes) {
+      pool.reset();
+      pool.emplace(size_bytes);
+      pool->prefault_memory();
+    }
+    pool->release_to(0);
+  }
+};
+
+static ptrdiff_t cpu_count(const std::vector<numa_node>& topology) {
+  ptrdiff_t count = 0;
+  for (const numa_node& node: topology) {
+    count += std::ssize(node.cpus);
+  }
+  return count;
+}
+
+numa_executor::numa_executor(std::vector<numa_node> topology):
+  worker_limit(tbb::global_control::max_allowed_parallelism, cpu_count(topology) + 1)
+{
+  for (auto& node: topology) {
+    nodes.push_back(std::make_unique<node_context>(std::move(node)));
+  }
+  log_out("NUMA executor over {} nodes", nodes.size());
+}
+
+numa_executor::~numa_executor() = default;
+
+void numa_executor::filter(const image& gbuf, std::span<float> dst, const filter_params& params) {
+  const int width = gbuf.meta.width;
+  const int height = gbuf.meta.height;
+  assert_release(std::ssize(dst) == 3 * gbuf.meta.total_pixels());
+
+  ptrdiff_t total_cpus = 0;
+  for (auto& ctx: nodes) {
+    total_cpus += std::ssize(ctx->node.cpus);
+  }
+
+  ptrdiff_t cpus_before = 0;
+  for (auto& ctx: nodes) {
+    const int y0 = height * cpus_before / total_cpus;
+    cpus_before += std::ssize(ctx->node.cpus);
+    const int y1 = height * cpus_before / total_cpus;
+    if (y0 == y1) {
+      continue;
+    }
+
+    ctx->arena.execute([&, ctx = ctx.get(), y0, y1] {
+      ctx->group.run([&, ctx, y0, y1] {
+        const int band_begin = std::max(0, y0 - filter_radius - 1);
+        const int band_end = std::min(height, y1 + filter_radius + 1);
+        ctx->reserve_pool(memory_pool::gbuffer_size_bytes(ptrdiff_t(band_end - band_begin) * width));
+        auto streams = ctx->pool->upload_gbuffer(gbuf, band_begin, band_end);
+        std::ranges::fill(streams.dst, 0.f);
+
+        image_meta band;
+        band.width = width;
+        band.height = band_end - band_begin;
+        band.first_row = band_begin;
+        linear_filter_band(band, streams, height, rect{0, y0, width, y1}, params);
+
+        const ptrdiff_t row = 3 * ptrdiff_t(width);
+        std::ranges::copy(
+          streams.dst.subspan((y0 - band_begin) * row, (y1 - y0) * row),
+          dst.begin() + y0 * row);
+      });
+    });
+  }
+
+  for (auto& ctx: nodes) {
+    ctx->arena.execute([&] {
+      ctx->group.wait();
+    });
+  }
+}
+
+}  // namespace filt
\ No newline at end of file
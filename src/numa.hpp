@@ -0,0 +1,39 @@
+#pragma once
+#include "image.hpp"
+#include "mempool.hpp"
+#include "util.hpp"
+#include <memory>
+#include <oneapi/tbb/global_control.h>
+#include <span>
+#include <vector>
+
+namespace filt {
+
+struct numa_node {
+  int id;
+  std::vector<int> cpus;
+};
+
+// nodes from /sys/devices/system/node with the cpus this process may use, or one node for all of them
+std::vector<numa_node> numa_topology();
+
+// linear_filter in one horizontal band per node, each with its own pinned arena and node-local pool
+class numa_executor: nonmovable {
+  struct node_context;
+  // tbb's default of one worker per cpu less the main thread would leave a node short
+  tbb::global_control worker_limit;
+  std::vector<std::unique_ptr<node_context>> nodes;
+
+public:
+  explicit numa_executor(std::vector<numa_node> topology = numa_topology());
+  ~numa_executor();
+
+  int node_count() const {
+    return std::ssize(nodes);
+  }
+
+  // linear_filter output of the whole frame into `dst`, interleaved rgb
+  void filter(const image& gbuffer, std::span<float> dst, const filter_params& params = {});
+};
+
+}  // namespace filt
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include "image.hpp"
+#include "mempool.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fmt/base.h>
+#include <fmt/color.h>
+#include <limits>
+
+// Filter throughput with the streams of memory_pool::upload_gbuffer placed three ways:
+// naive (every stream page-aligned), the hand-picked defaults of gbuffer_placement, and
+// memory_pool::plan_gbuffer, which filter uses with --plan-placement. Widths whose rows are a
+// multiple of a page long are where page-aligned neighbourhood rows alias the most.
+//   placement_bench [height]
+
+static double megapixels_per_second(
+  filt::image& gbuf,
+  int tile_size,
+  const filt::gbuffer_placement& placement
+) {
+  auto& meta = gbuf.meta;
+  auto pool = filt::memory_pool(filt::memory_pool::gbuffer_size_bytes(
+    filt::tiled_pixel_count(meta.width, meta.height, tile_size)));
+  auto streams = pool.upload_gbuffer(gbuf, 0, meta.height, tile_size, placement);
+
+  double best = std::numeric_limits<double>::infinity();
+  for (int i = 0; i < 5; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    filt::linear_filter(meta, streams);
+    best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+  return meta.total_pixels() / best * 1e-6;
+}
+
+int main(int argc, char** argv) try {
+  const int height = argc > 1 ? std::stoi(argv[1]) : 540;
+
+  for (const filt::cache_level& cache: filt::cache_geometry()) {
+    fmt::println(
+      "L{}: {} sets × {} ways × {} B lines",
+      cache.level, cache.sets, cache.ways, cache.line_size);
+  }
+
+  const filt::gbuffer_placement naive{.color = 0, .albedo = 0, .normals = 0, .dst = 0, .z = 0};
+  const filt::gbuffer_placement hand_picked{};
+
+  fmt::println("width\ttile\tnaive MP/s\thand-picked MP/s\tplanned MP/s\tplanned offsets");
+  for (int width: {1024, 1920, 2048, 3840, 4096}) {
+    auto gbuf = filt::image::make_synthetic_gbuffer(width, height);
+    for (int tile_size: {0, 8}) {
+      const auto planned = filt::memory_pool::plan_gbuffer(width, tile_size);
+      fmt::println(
+        "{}\t{}\t{:.3f}\t{:.3f}\t{:.3f}\t{} {} {} {} {}",
+        width, tile_size,
+        megapixels_per_second(gbuf, tile_size, naive),
+        megapixels_per_second(gbuf, tile_size, hand_picked),
+        megapixels_per_second(gbuf, tile_size, planned),
+        planned.color, planned.albedo, planned.normals, planned.dst, planned.z);
+    }
+  }
+
+} catch (const std::exception& ex) {
+  fmt::print(
+    stderr, fg(fmt::terminal_color::red) | fmt::emphasis::bold,
+    "Error: {}\n", ex.what());
+  return 1;
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+#include "uring.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <png.h>
+#include <span>
+#include <stdexcept>
+
+// encodes through a libpng write callback into a uring_file_writer
+class png_writer {
+  png_structp write_struct = nullptr;
+  png_infop info_struct = nullptr;
+  std::optional<filt::uring_file_writer> out_file;
+
+  void cleanup() {
+    // libpng cleanup is messy, so do it all here
+    png_destroy_write_struct(&write_struct, &info_struct);
+    out_file.reset();
+  }
+
+  static void write_callback(png_structp png, png_bytep data, size_t size) {
+    static_cast<filt::uring_file_writer*>(png_get_io_ptr(png))->append(data, size);
+  }
+
+  static void flush_callback(png_structp) {}
+
+public:
+  explicit png_writer(const char* filename) {
+    try {
+      write_struct = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+      if (!write_struct) {
+        throw std::runtime_error("cannot create libpng write struct");
+      }
+      info_struct = png_create_info_struct(write_struct);
+      if (!info_struct) {
+        throw std::runtime_error("cannot create libpng info struct");
+      }
+      out_file.emplace(filename);
+    } catch (...) {
+      cleanup();
+      throw;
+    }
+
+    png_set_write_fn(write_struct, &*out_file, write_callback, flush_callback);
+  }
+
+  ~png_writer() {
+    cleanup();
+  }
+
+  png_writer(png_writer&&) = delete;
+  png_writer(const png_writer&) = delete;
+  png_writer& operator=(png_writer&&) = delete;
+  png_writer& operator=(const png_writer&) = delete;
+
+  void write(int width, std::span<const unsigned char* const> rows, int color_type) && {
+    int height = std::ssize(rows);
+    begin(width, height, color_type);
+    png_write_image(write_struct, const_cast<unsigned char**>(rows.data()));
+    std::move(*this).end();
+  }
+
+  // begin(), then write_row() for each of the `height` rows top to bottom, then end()
+  void begin(int width, int height, int color_type) {
+    png_set_IHDR(
+      write_struct,
+      info_struct,
+      width, height, 8,
+      color_type,
+      PNG_INTERLACE_NONE,
+      PNG_COMPRESSION_TYPE_DEFAULT,
+      PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(write_struct, info_struct);
+  }
+
+  void write_row(const unsigned char* row) {
+    png_write_row(write_struct, row);
+  }
+
+  void end() && {
+    png_write_end(write_struct, nullptr);
+    out_file->close();
+  }
+
+  void write_grayscale(int width, std::span<const unsigned char* const> rows) && {
+    return std::move(*this).write(width, rows, PNG_COLOR_TYPE_GRAY);
+  }
+
+  void write_rgb_interleaved(int width, std::span<const unsigned char* const> rows) && {
+    return std::move(*this).write(width, rows, PNG_COLOR_TYPE_RGB);
+  }
+};
+
+inline uint8_t clamp_float_value(float f) {
+  return std::clamp(f, 0.f, 1.0f) * 255.f;
+}
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "raw_output.hpp"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace filt {
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little, "raw output is written as little-endian");
+
+// round to nearest even, overflow to infinity, nan stays nan
+uint16_t float_to_half(float value) {
+  const uint32_t bits = std::bit_cast<uint32_t>(value);
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  const uint32_t magnitude = bits & 0x7fffffff;
+  if (magnitude >= 0x7f800000) {
+    return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+  }
+  // 65520 and up round past the largest half, 65504
+  if (magnitude >= 0x477ff000) {
+    return sign | 0x7c00;
+  }
+  // below 2^-14 the half is subnormal, in units of 2^-24; rounding up may give the smallest normal,
+  // whose bits follow on directly
+  if (magnitude < 0x38800000) {
+    return sign | uint16_t(std::nearbyint(std::bit_cast<float>(magnitude) * 0x1p24f));
+  }
+  // rebias the exponent from 127 to 15 and keep 10 mantissa bits; a carry out of the mantissa
+  // correctly bumps the exponent
+  uint32_t half = (magnitude - 0x38000000) >> 13;
+  const uint32_t rest = magnitude & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | uint16_t(half);
+}
+
+void write_all(int fd, const void* data, ptrdiff_t size) {
+  auto bytes = static_cast<const std::byte*>(data);
+  while (size > 0) {
+    ssize_t written = ::write(fd, bytes, size);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw errno_error("write raw output");
+    }
+    bytes += written;
+    size -= written;
+  }
+}
+
+}  // namespace
+
+raw_format parse_raw_format(std::string_view name) {
+  if (name == "float") {
+    return raw_format::f32;
+  }
+  if (name == "half") {
+    return raw_format::f16;
+  }
+  if (name == "pfm") {
+    return raw_format::pfm;
+  }
+  throw fmt_runtime_error("unknown raw format {}", name);
+}
+
+raw_writer::raw_writer(const char* path, raw_format out_format, int frame_width, int frame_height):
+  format(out_format),
+  width(frame_width)
+{
+  if (std::string_view(path) == "-") {
+    fd = STDOUT_FILENO;
+    owns_fd = false;
+  } else {
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+      throw errno_error("open raw output");
+    }
+    owns_fd = true;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      file.emplace(std::exchange(fd, -1));
+    }
+  }
+
+  if (format == raw_format::f16) {
+    half_row.resize(3 * ptrdiff_t(width));
+  }
+
+  if (format == raw_format::pfm) {
+    // negative scale: little-endian
+    const std::string header = fmt::format("PF\n{} {}\n-1.0\n", width, frame_height);
+    write(header.data(), std::ssize(header));
+  }
+}
+
+raw_writer::~raw_writer() {
+  if (owns_fd && fd != -1) {
+    ::close(fd);
+  }
+}
+
+void raw_writer::close() {
+  if (file) {
+    file->close();
+  }
+}
+
+void raw_writer::write(const void* data, ptrdiff_t size) {
+  if (file) {
+    file->append(data, size);
+  } else {
+    write_all(fd, data, size);
+  }
+}
+
+void raw_writer::write_row(std::span<const float> rgb) {
+  assert_release(std::ssize(rgb) == 3 * ptrdiff_t(width));
+  if (format == raw_format::f16) {
+    std::ranges::transform(rgb, half_row.begin(), float_to_half);
+    write(half_row.data(), std::ssize(half_row) * ptrdiff_t(sizeof(uint16_t)));
+  } else {
+    write(rgb.data(), std::ssize(rgb) * ptrdiff_t(sizeof(float)));
+  }
+}
+
+}  // namespace filt
@@ -0,0 +1,54 @@
+#pragma once
+#include "stripes.hpp"
+#include "uring.hpp"
+#include "util.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace filt {
+
+enum class raw_format {
+  // headerless interleaved rgb, little-endian
+  f32,
+  f16,
+  // portable float map: a short text header, then float32 rows bottom to top
+  pfm,
+};
+
+raw_format parse_raw_format(std::string_view name);
+
+// filtered rows for a downstream tool: blocking writes to a pipe, uring_file_writer to a regular file
+class raw_writer: nonmovable {
+  int fd = -1;
+  bool owns_fd;
+  std::optional<uring_file_writer> file;
+  raw_format format;
+  int width;
+  // conversion scratch for f16
+  std::vector<uint16_t> half_row;
+
+public:
+  // "-" is stdout; any other path is opened for writing, which includes named pipes
+  raw_writer(const char* path, raw_format out_format, int frame_width, int frame_height);
+  ~raw_writer();
+
+  // the order write_row expects the rows in
+  row_order order() const {
+    return format == raw_format::pfm ? row_order::bottom_up : row_order::top_down;
+  }
+
+  // 3 * width interleaved floats
+  void write_row(std::span<const float> rgb);
+
+  // waits for buffered writes to a regular file; throws the first write error
+  void close();
+
+private:
+  void write(const void* data, ptrdiff_t size);
+};
+
+}  // namespace filt
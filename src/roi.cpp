@@ -0,0 +1,113 @@
+#include "roi.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace filt {
+
+// `dst` is interleaved rgb of `crop`, and both rects are in frame coordinates
+static void read_rgb(const image& out, const rect& crop, std::span<float> dst) {
+  const linear_channel* channels[3] = {
+    &out.meta.find_channel("R"),
+    &out.meta.find_channel("G"),
+    &out.meta.find_channel("B"),
+  };
+  for (int y = crop.y0; y < crop.y1; ++y) {
+    const ptrdiff_t crop_row = ptrdiff_t(y - crop.y0) * crop.width() - crop.x0;
+    for (int x = crop.x0; x < crop.x1; ++x) {
+      for (int i = 0; i < 3; ++i) {
+        dst[3 * (crop_row + x) + i] = out.sample(*channels[i], x, y);
+      }
+    }
+  }
+}
+
+static void patch_rgb(image& out, const rect& area, const rect& crop, std::span<const float> dst) {
+  const linear_channel* channels[3] = {
+    &out.meta.find_channel("R"),
+    &out.meta.find_channel("G"),
+    &out.meta.find_channel("B"),
+  };
+  for (int y = area.y0; y < area.y1; ++y) {
+    const ptrdiff_t crop_row = ptrdiff_t(y - crop.y0) * crop.width() - crop.x0;
+    for (int x = area.x0; x < area.x1; ++x) {
+      for (int i = 0; i < 3; ++i) {
+        out.data[channels[i]->offset_elems(x, y)] = dst[3 * (crop_row + x) + i];
+      }
+    }
+  }
+}
+
+void roi_filter(
+  const char* exr_filename,
+  std::span<const rect> rois,
+  image& out,
+  memory_pool& pool,
+  const filter_params& params
+) {
+  std::vector<rect> sorted(rois.begin(), rois.end());
+  std::erase_if(sorted, [](const rect& r) { return r.empty(); });
+  std::ranges::sort(sorted, {}, &rect::y0);
+
+  // one row more than the kernel reaches, for where it wraps around row ends
+  constexpr int halo = filter_radius + 1;
+  const int width = out.meta.width;
+  exr_reader exr(exr_filename);
+  for (auto group = sorted.begin(); group != sorted.end();) {
+    // grow the band while the next roi's halo overlaps it
+    int band_begin = group->y0 - halo;
+    int band_end = group->y1 + halo;
+    auto group_end = std::next(group);
+    while (group_end != sorted.end() && group_end->y0 - halo <= band_end) {
+      band_end = std::max(band_end, group_end->y1 + halo);
+      ++group_end;
+    }
+
+    auto band = exr.read(is_gbuffer_channel, band_begin, band_end);
+    assert_release(band.meta.width == width);
+    const int first_row = band.meta.first_row;
+    if (band.meta.height == 0) {
+      group = group_end;
+      continue;
+    }
+
+    // the decode is shared, but each roi uploads only itself and its halo
+    for (auto roi = group; roi != group_end; ++roi) {
+      const rect area = roi->intersect(rect{0, first_row, width, first_row + band.meta.height});
+      if (area.empty()) {
+        continue;
+      }
+      // near the left and right edges the kernel wraps into the neighbouring rows' far ends,
+      // so those rois take whole rows
+      const bool wraps = area.x0 < filter_radius || area.x1 > width - filter_radius;
+      const rect reach = wraps
+        ? rect{0, area.y0 - halo, width, area.y1 + halo}
+        : rect{area.x0 - filter_radius, area.y0 - halo, area.x1 + filter_radius, area.y1 + halo};
+      const rect crop = reach.translate(0, -first_row)
+        .intersect(rect{0, 0, width, band.meta.height})
+        .translate(0, first_row);
+
+      const ptrdiff_t mark = pool.top;
+      auto streams = pool.upload_gbuffer(band, crop.translate(0, -first_row));
+      image_meta crop_meta;
+      crop_meta.width = crop.width();
+      crop_meta.height = crop.height();
+      crop_meta.first_row = crop.y0;
+      // pixels the kernel does not reach, as near the top and bottom, keep what `out` had
+      read_rgb(out, crop, streams.dst);
+      if (wraps) {
+        linear_filter_band(crop_meta, streams, out.meta.height, area, params);
+      } else {
+        linear_filter(crop_meta, streams, area.translate(-crop.x0, -crop.y0), params);
+      }
+      patch_rgb(out, area, crop, streams.dst);
+      pool.release_to(mark);
+    }
+
+    log_out("Filtered {} rois in rows [{}, {})",
+      std::distance(group, group_end), first_row, first_row + band.meta.height);
+    group = group_end;
+  }
+}
+
+}  // namespace filt
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+#include "image.hpp"
+#include "mempool.hpp"
+#include <span>
+
+namespace filt {
+
+// linear_filter's pixels of `rois` (frame coordinates), decoding only the rows they need, patched into
+// `out`, an rgb image of the frame's size
+void roi_filter(
+  const char* exr_filename,
+  std::span<const rect> rois,
+  image& out,
+  memory_pool& pool,
+  const filter_params& params = {});
+
+}  // namespace filt
\ No newline at end of file
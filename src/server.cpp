@@ -0,0 +1,283 @@
+#include "server.hpp"
+#include "image.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <oneapi/tbb/parallel_for.h>
+#include <oneapi/tbb/task_arena.h>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace filt {
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+double micros_between(clock::time_point from, clock::time_point to) {
+  return std::chrono::duration<double, std::micro>(to - from).count();
+}
+
+struct unique_fd: noncopyable {
+  int fd = -1;
+
+  explicit unique_fd(int f):
+    fd(f)
+  {}
+
+  unique_fd(unique_fd&& other):
+    fd(std::exchange(other.fd, -1))
+  {}
+
+  ~unique_fd() {
+    if (fd != -1) {
+      ::close(fd);
+    }
+  }
+};
+
+struct job {
+  std::string input;
+  std::string output;
+  filter_params params;
+};
+
+template<typename T>
+T parse_number(std::string_view key, std::string_view text) {
+  T result;
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), result);
+  if (ec != std::errc() || end != text.data() + text.size()) {
+    throw fmt_runtime_error("bad value {} for {}", text, key);
+  }
+  return result;
+}
+
+job parse_job(std::string_view line) {
+  std::vector<std::string_view> words;
+  for (size_t at = 0; at < line.size();) {
+    at = line.find_first_not_of(" \t\r", at);
+    if (at == line.npos) {
+      break;
+    }
+    size_t end = std::min(line.find_first_of(" \t\r", at), line.size());
+    words.push_back(line.substr(at, end - at));
+    at = end;
+  }
+  if (words.size() < 2) {
+    throw std::runtime_error("expected <input.exr> <output.png> [key=value...]");
+  }
+
+  job result{.input = std::string(words[0]), .output = std::string(words[1]), .params = {}};
+  for (std::string_view word: std::span(words).subspan(2)) {
+    size_t eq = word.find('=');
+    if (eq == word.npos) {
+      throw fmt_runtime_error("expected key=value, got {}", word);
+    }
+    std::string_view key = word.substr(0, eq);
+    std::string_view value = word.substr(eq + 1);
+    if (key == "sigma") {
+      result.params.intensity_sigma = parse_number<float>(key, value);
+    } else if (key == "normal-dot") {
+      result.params.min_normal_dot = parse_number<float>(key, value);
+    } else if (key == "grain") {
+      result.params.grain_rows = parse_number<int>(key, value);
+    } else if (key == "luma-chroma") {
+      result.params.luma_chroma = parse_number<int>(key, value) != 0;
+    } else if (key == "exp") {
+      result.params.exp = parse_exp_variant(value);
+    } else {
+      throw fmt_runtime_error("unknown parameter {}", key);
+    }
+  }
+  return result;
+}
+
+void send_all(int fd, std::string_view text) {
+  while (!text.empty()) {
+    ssize_t sent = ::send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+    if (sent == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw errno_error("send");
+    }
+    text.remove_prefix(sent);
+  }
+}
+
+struct server: nonmovable {
+  memory_pool pool;
+  // held from upload until the filtered rgb is copied out
+  std::mutex pool_mutex;
+  tbb::task_arena arena;
+  // one per connection thread
+  std::counting_semaphore<> connection_slots;
+
+  explicit server(const server_options& options):
+    pool(options.pool_bytes),
+    arena(options.threads > 0 ? options.threads : tbb::task_arena::automatic),
+    connection_slots(options.max_connections)
+  {
+    pool.prefault_memory();
+    arena.initialize();
+    arena.execute([&] {
+      tbb::parallel_for(0, arena.max_concurrency(), [](int) {});
+    });
+  }
+
+  // decode_us leaves out the wait for another connection's job to release the pool
+  std::string run(const job& j) {
+    const auto started = clock::now();
+    auto gbuf = image(j.input.c_str(), is_gbuffer_channel);
+    const ptrdiff_t needed = memory_pool::gbuffer_size_bytes(gbuf.meta.total_pixels());
+    if (needed > std::ssize(pool.memory)) {
+      throw fmt_runtime_error(
+        "{}×{} frame needs {} MiB of pool, have {} MiB",
+        gbuf.meta.width, gbuf.meta.height, needed >> 20, std::ssize(pool.memory) >> 20);
+    }
+    const auto loaded = clock::now();
+
+    std::unique_lock lock(pool_mutex);
+    const auto acquired = clock::now();
+    pool.release_to(0);
+    auto streams = pool.upload_gbuffer(gbuf);
+    const auto decoded = clock::now();
+
+    arena.execute([&] {
+      linear_filter(gbuf.meta, streams, j.params);
+    });
+    const std::vector<float> filtered_rgb(streams.dst.begin(), streams.dst.end());
+    lock.unlock();
+    const auto filtered = clock::now();
+
+    dump_png_rgb_interleaved(j.output.c_str(), gbuf.meta.width, gbuf.meta.height, filtered_rgb);
+    const auto written = clock::now();
+
+    return fmt::format(
+      "ok decode_us={:.0f} filter_us={:.0f} write_us={:.0f}\n",
+      micros_between(started, loaded) + micros_between(acquired, decoded),
+      micros_between(decoded, filtered),
+      micros_between(filtered, written));
+  }
+
+  std::string respond(std::string_view line) {
+    try {
+      return run(parse_job(line));
+    } catch (const std::exception& ex) {
+      std::string message = ex.what();
+      std::ranges::replace(message, '\n', ' ');
+      return fmt::format("error {}\n", message);
+    }
+  }
+
+  void handle(unique_fd connection) {
+    std::string buffer;
+    char chunk[4096];
+    for (;;) {
+      ssize_t got = ::recv(connection.fd, chunk, sizeof(chunk), 0);
+      if (got == -1 && errno == EINTR) {
+        continue;
+      }
+      // EAGAIN: timed out
+      if (got <= 0) {
+        return;
+      }
+      buffer.append(chunk, got);
+
+      size_t newline;
+      while ((newline = buffer.find('\n')) != buffer.npos) {
+        std::string line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        send_all(connection.fd, respond(line));
+      }
+    }
+  }
+};
+
+unique_fd listen_on(const char* socket_path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (std::strlen(socket_path) >= sizeof(address.sun_path)) {
+    throw fmt_runtime_error("socket path {} is too long", socket_path);
+  }
+  std::strcpy(address.sun_path, socket_path);
+
+  // a socket left behind by a previous daemon, never a regular file
+  struct stat st;
+  if (::lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    ::unlink(socket_path);
+  }
+
+  auto listener = unique_fd(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (listener.fd == -1) {
+    throw errno_error("socket");
+  }
+  if (::bind(listener.fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1) {
+    throw errno_error("bind");
+  }
+  if (::listen(listener.fd, 16) == -1) {
+    throw errno_error("listen");
+  }
+  return listener;
+}
+
+void set_timeouts(int fd, int seconds) {
+  const timeval timeout{.tv_sec = seconds, .tv_usec = 0};
+  for (int option: {SO_RCVTIMEO, SO_SNDTIMEO}) {
+    if (::setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout)) == -1) {
+      throw errno_error("setsockopt");
+    }
+  }
+}
+
+}  // namespace
+
+void serve(const char* socket_path, const server_options& options) {
+  if (options.max_connections <= 0 || options.timeout_seconds <= 0) {
+    throw fmt_runtime_error(
+      "bad server options: {} connections, {} s timeout",
+      options.max_connections, options.timeout_seconds);
+  }
+  // shared with the detached connection threads, which may outlive a throwing accept
+  auto state = std::make_shared<server>(options);
+  auto listener = listen_on(socket_path);
+  fmt::println("Listening on {} with {} threads", socket_path, state->arena.max_concurrency());
+  std::fflush(stdout);
+
+  for (;;) {
+    state->connection_slots.acquire();
+    int fd;
+    while ((fd = ::accept4(listener.fd, nullptr, nullptr, SOCK_CLOEXEC)) == -1) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        throw errno_error("accept");
+      }
+    }
+
+    std::thread([state, timeout = options.timeout_seconds, connection = unique_fd(fd)] mutable {
+      try {
+        set_timeouts(connection.fd, timeout);
+        state->handle(std::move(connection));
+      } catch (const std::exception& ex) {
+        log_out("Dropped connection: {}", ex.what());
+      }
+      state->connection_slots.release();
+    }).detach();
+  }
+}
+
+}  // namespace filt
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+#include "mempool.hpp"
+#include <cstddef>
+
+namespace filt {
+
+struct server_options {
+  ptrdiff_t pool_bytes = memory_pool::default_size;
+  // tbb arena size, 0 for the tbb default
+  int threads = 0;
+  // connections served at once; further ones wait in the listen backlog
+  int max_connections = 16;
+  // a connection that sends nothing, or takes no response, for this long is closed
+  int timeout_seconds = 30;
+};
+
+// Filter daemon on a unix stream socket, sharing one prefaulted pool and arena; each request is one line
+//   <input.exr> <output.png> [sigma=<float>] [normal-dot=<float>] [grain=<rows>]
+//   [exp=<exact|bit-trick|poly3|lut>] [luma-chroma=<0|1>]
+// answered, in order, by one line
+//   ok decode_us=<n> filter_us=<n> write_us=<n>
+//   error <message>
+// One thread per connection; only upload and filter take turns on the pool. Paths cannot contain
+// whitespace.
+[[noreturn]] void serve(const char* socket_path, const server_options& options);
+
+}  // namespace filt
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "stripes.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace filt {
+
+// one row more than the kernel reaches, for where it wraps around row ends
+constexpr int stripe_halo = filter_radius + 1;
+
+int max_stripe_rows(const memory_pool& pool, int width) {
+  const ptrdiff_t free_bytes = std::ssize(pool.memory) - pool.top;
+  // gbuffer_size_bytes is affine in the pixel count, so search for the largest fit
+  int lo = 0;
+  int hi = std::numeric_limits<int>::max() / 2;
+  while (lo < hi) {
+    const int mid = lo + (hi - lo + 1) / 2;
+    const ptrdiff_t band_pixels = ptrdiff_t(mid + 2 * stripe_halo) * width;
+    if (memory_pool::gbuffer_size_bytes(band_pixels) <= free_bytes) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  if (lo == 0) {
+    throw fmt_runtime_error("Not enough pool memory for a single {} pixel wide stripe", width);
+  }
+  return lo;
+}
+
+void stripe_filter(
+  const char* exr_filename,
+  memory_pool& pool,
+  int stripe_rows,
+  const row_sink& sink,
+  const filter_params& params,
+  row_order order
+) {
+  exr_reader exr(exr_filename);
+  const rect frame = exr.data_window();
+  if (stripe_rows <= 0) {
+    stripe_rows = max_stripe_rows(pool, frame.width());
+  }
+
+  const ptrdiff_t width = frame.width();
+  const bool bottom_up = order == row_order::bottom_up;
+  const int stripes = (frame.height() + stripe_rows - 1) / stripe_rows;
+  for (int i = 0; i < stripes; ++i) {
+    const int y0 = (bottom_up ? stripes - 1 - i : i) * stripe_rows;
+    const int y1 = std::min(frame.height(), y0 + stripe_rows);
+
+    auto band = exr.read(is_gbuffer_channel, y0 - stripe_halo, y1 + stripe_halo);
+    const int first_row = band.meta.first_row;
+
+    const ptrdiff_t mark = pool.top;
+    auto streams = pool.upload_gbuffer(band);
+    std::ranges::fill(streams.dst, 0.f);
+
+    linear_filter_band(band.meta, streams, frame.height(), rect{0, y0, frame.width(), y1}, params);
+    const rect stripe{0, y0 - first_row, frame.width(), y1 - first_row};
+
+    for (int k = 0; k < stripe.height(); ++k) {
+      const int y = bottom_up ? stripe.y1 - 1 - k : stripe.y0 + k;
+      sink(
+        first_row + y,
+        streams.color.subspan(3 * y * width, 3 * width),
+        streams.dst.subspan(3 * y * width, 3 * width));
+    }
+
+    pool.release_to(mark);
+    log_out("Filtered stripe [{}, {})", y0, y1);
+  }
+}
+
+}  // namespace filt
\ No newline at end of file
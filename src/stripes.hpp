@@ -0,0 +1,32 @@
+#pragma once
+#include "image.hpp"
+#include "mempool.hpp"
+#include <functional>
+#include <span>
+
+namespace filt {
+
+// Receives finished frame rows in the order stripe_filter was asked for: row `y` of the noisy
+// color and of the filtered result, both interleaved rgb, 3 * width floats.
+using row_sink = std::function<void(int y, std::span<const float> color, std::span<const float> filtered)>;
+
+enum class row_order {
+  top_down,
+  // last stripe first and each stripe's rows bottom to top, for formats stored that way
+  bottom_up,
+};
+
+// tallest stripe whose gbuffer streams, halo included, fit into what is left of `pool`
+int max_stripe_rows(const memory_pool& pool, int width);
+
+// linear_filter one stripe of `stripe_rows` scanlines at a time (max_stripe_rows if <= 0), rows
+// reaching `sink` in `order`
+void stripe_filter(
+  const char* exr_filename,
+  memory_pool& pool,
+  int stripe_rows,
+  const row_sink& sink,
+  const filter_params& params = {},
+  row_order order = row_order::top_down);
+
+}  // namespace filt
\ No newline at end of file
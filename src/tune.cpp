@@ -0,0 +1,263 @@
+#include "tune.hpp"
+#include "mempool.hpp"
+#include "numa.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <oneapi/tbb/task_arena.h>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+namespace filt {
+
+std::string tuned_config_path() {
+  char host[256] = {};
+  if (::gethostname(host, sizeof(host) - 1) == -1) {
+    throw errno_error("gethostname");
+  }
+
+  std::filesystem::path dir;
+  if (const char* xdg = std::getenv("XDG_CONFIG_HOME"); xdg && *xdg) {
+    dir = xdg;
+  } else if (const char* home = std::getenv("HOME"); home && *home) {
+    dir = std::filesystem::path(home) / ".config";
+  } else {
+    throw std::runtime_error("neither XDG_CONFIG_HOME nor HOME is set");
+  }
+  return dir / "filt" / fmt::format("{}.conf", host);
+}
+
+static int parse_config_int(const std::string& path, std::string_view key, std::string_view text) {
+  int result;
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), result);
+  if (ec != std::errc() || end != text.data() + text.size() || result < 0) {
+    throw fmt_runtime_error("{}: bad value {} for {}", path, text, key);
+  }
+  return result;
+}
+
+std::optional<tuned_config> load_tuned_config(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    return std::nullopt;
+  }
+
+  tuned_config result;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line.starts_with('#')) {
+      continue;
+    }
+    const size_t eq = line.find('=');
+    if (eq == line.npos) {
+      throw fmt_runtime_error("{}: expected key=value, got {}", path, line);
+    }
+    std::string_view key = std::string_view(line).substr(0, eq);
+    std::string_view value = std::string_view(line).substr(eq + 1);
+    if (key == "grain") {
+      result.grain_rows = std::max(1, parse_config_int(path, key, value));
+    } else if (key == "tile") {
+      result.tile_size = parse_config_int(path, key, value);
+      if (result.tile_size != 0 && result.tile_size != 8 && result.tile_size != 16) {
+        throw fmt_runtime_error("{}: unsupported tile size {}", path, result.tile_size);
+      }
+    } else if (key == "plan-placement") {
+      result.plan_placement = parse_config_int(path, key, value) != 0;
+    } else if (key == "threads") {
+      result.threads = parse_config_int(path, key, value);
+    } else if (key == "exp") {
+      result.exp = parse_exp_variant(value);
+    } else if (key == "numa") {
+      result.numa = parse_config_int(path, key, value) != 0;
+    } else {
+      throw fmt_runtime_error("{}: unknown key {}", path, key);
+    }
+  }
+  return result;
+}
+
+void save_tuned_config(const std::string& path, const tuned_config& config) {
+  std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+
+  const std::string temp_path = fmt::format("{}.{}.tmp", path, ::getpid());
+  {
+    std::ofstream file(temp_path);
+    file << fmt::format(
+      "# written by filter --autotune\n"
+      "grain={}\ntile={}\nplan-placement={}\nthreads={}\nexp={}\nnuma={}\n",
+      config.grain_rows, config.tile_size, int(config.plan_placement), config.threads,
+      to_string(config.exp), int(config.numa));
+    if (!file.flush()) {
+      throw fmt_runtime_error("cannot write {}", temp_path);
+    }
+  }
+  std::filesystem::rename(temp_path, path);
+}
+
+namespace {
+
+constexpr int timed_runs = 3;
+
+// the best of `timed_runs` calls of `f`, in megapixels per second
+template<typename F>
+double best_throughput(const image_meta& meta, F&& f) {
+  double best = std::numeric_limits<double>::infinity();
+  for (int i = 0; i < timed_runs; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+  return meta.total_pixels() / best * 1e-6;
+}
+
+// the variants whose filtered gbuffer stays within min_exp_psnr_db of the exact exp, compared
+// like exp_bench does: clamped to [0, 1], away from the unfiltered border
+std::vector<exp_variant> accurate_exp_variants(const image& gbuffer) {
+  image_meta meta = gbuffer.meta;
+  auto pool = memory_pool(memory_pool::gbuffer_size_bytes(meta.total_pixels()));
+  auto streams = pool.upload_gbuffer(gbuffer, 0, meta.height);
+
+  filter_params params;
+  params.exp = exp_variant::exact;
+  linear_filter(meta, streams, params);
+  const std::vector<float> reference(streams.dst.begin(), streams.dst.end());
+
+  const double max_mse = std::pow(10., -min_exp_psnr_db / 10);
+  std::vector<exp_variant> result;
+  for (exp_variant v: all_exp_variants) {
+    params.exp = v;
+    linear_filter(meta, streams, params);
+
+    double squared = 0;
+    ptrdiff_t count = 0;
+    for (int y = filter_radius; y < meta.height - filter_radius; ++y) {
+      for (int x = filter_radius; x < meta.width - filter_radius; ++x) {
+        for (int c = 0; c < 3; ++c) {
+          const ptrdiff_t at = 3 * (ptrdiff_t(y) * meta.width + x) + c;
+          const double error = std::clamp(streams.dst[at], 0.f, 1.f) - std::clamp(reference[at], 0.f, 1.f);
+          squared += error * error;
+          ++count;
+        }
+      }
+    }
+    if (count == 0 || squared <= max_mse * count) {
+      result.push_back(v);
+    } else {
+      log_out("exp {} is too far from exact, {} dB", to_string(v), -10 * std::log10(squared / count));
+    }
+  }
+  return result;
+}
+
+struct tuner {
+  const image& gbuffer;
+  std::unique_ptr<numa_executor> executor;
+
+  double measure(const tuned_config& config) {
+    filter_params params;
+    params.grain_rows = config.grain_rows;
+    params.exp = config.exp;
+
+    if (config.numa) {
+      std::vector<float> dst(3 * gbuffer.meta.total_pixels());
+      return best_throughput(gbuffer.meta, [&] {
+        executor->filter(gbuffer, dst, params);
+      });
+    }
+
+    image_meta meta = gbuffer.meta;
+    auto pool = memory_pool(memory_pool::gbuffer_size_bytes(
+      tiled_pixel_count(meta.width, meta.height, config.tile_size)));
+    auto streams = pool.upload_gbuffer(
+      gbuffer, 0, meta.height, config.tile_size,
+      config.plan_placement
+        ? memory_pool::plan_gbuffer(meta.width, config.tile_size)
+        : gbuffer_placement{});
+    auto arena = tbb::task_arena(config.threads > 0 ? config.threads : tbb::task_arena::automatic);
+    return arena.execute([&] {
+      return best_throughput(meta, [&] {
+        linear_filter(meta, streams, params);
+      });
+    });
+  }
+};
+
+}  // namespace
+
+tuned_config autotune(
+  const image& gbuffer,
+  const std::function<void(const tuned_config&, double)>& report
+) {
+  const auto topology = numa_topology();
+  tuner t{.gbuffer = gbuffer, .executor = nullptr};
+  if (topology.size() > 1) {
+    t.executor = std::make_unique<numa_executor>(topology);
+  }
+
+  int cpus = 0;
+  for (const numa_node& node: topology) {
+    cpus += std::ssize(node.cpus);
+  }
+  // fewer threads than cpus can win where the kernel is bandwidth bound
+  std::vector<int> thread_counts;
+  for (int n = cpus / 2; n > 0 && std::ssize(thread_counts) < 2; n /= 2) {
+    thread_counts.push_back(n);
+  }
+
+  const std::vector<exp_variant> exp_variants = accurate_exp_variants(gbuffer);
+  tuned_config best;
+  if (std::ranges::find(exp_variants, best.exp) == exp_variants.end()) {
+    best.exp = exp_variant::exact;
+  }
+  double best_mps = 0;
+  auto try_config = [&](const tuned_config& config) {
+    const double mps = t.measure(config);
+    if (report) {
+      report(config, mps);
+    }
+    if (mps > best_mps) {
+      best = config;
+      best_mps = mps;
+    }
+  };
+  // every candidate of one knob with the others at the best so far
+  auto tune_knob = [&](auto member, const auto& candidates) {
+    const tuned_config base = best;
+    for (const auto& value: candidates) {
+      if (base.*member == value) {
+        continue;
+      }
+      tuned_config config = base;
+      config.*member = value;
+      try_config(config);
+    }
+  };
+
+  try_config(best);
+  tune_knob(&tuned_config::tile_size, std::array{0, 8, 16});
+  tune_knob(&tuned_config::plan_placement, std::array{false, true});
+  tune_knob(&tuned_config::exp, exp_variants);
+  tune_knob(&tuned_config::grain_rows, std::array{1, 2, 4, 8, 16, 32, 64});
+  tune_knob(&tuned_config::threads, thread_counts);
+  if (t.executor) {
+    // numa_executor has its own threads and only the row-major layout
+    tuned_config config = best;
+    config.numa = true;
+    config.tile_size = 0;
+    config.plan_placement = false;
+    config.threads = 0;
+    try_config(config);
+  }
+  return best;
+}
+
+}  // namespace filt
\ No newline at end of file
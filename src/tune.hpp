@@ -0,0 +1,42 @@
+#pragma once
+#include "image.hpp"
+#include <functional>
+#include <optional>
+#include <string>
+
+namespace filt {
+
+// Knobs whose best values differ between machines. None of them changes the filtered image,
+// except exp, which autotune only sets to a variant within min_exp_psnr_db of the exact one.
+struct tuned_config {
+  int grain_rows = filter_params{}.grain_rows;
+  int tile_size = 0;
+  // memory_pool::plan_gbuffer offsets instead of the hand-picked ones
+  bool plan_placement = false;
+  // 0 uses every cpu the process may run on
+  int threads = 0;
+  exp_variant exp = filter_params{}.exp;
+  // split frames between NUMA nodes with numa_executor
+  bool numa = false;
+};
+
+// $XDG_CONFIG_HOME/filt/<hostname>.conf, or under ~/.config; throws when neither variable is set
+std::string tuned_config_path();
+
+// nullopt if the file does not exist; throws if it exists but does not parse
+std::optional<tuned_config> load_tuned_config(const std::string& path);
+
+// key=value lines, written atomically (temporary file + rename)
+void save_tuned_config(const std::string& path, const tuned_config& config);
+
+// PSNR, over the 8-bit range the pngs keep, that the output of an approximate exp must reach
+// against the exact one on the tuning image. Quantizing to 8 bits alone is ~59 dB.
+constexpr double min_exp_psnr_db = 70;
+
+// coordinate descent from the defaults over tile size, placement, exp, grain, threads and numa, skipping
+// exp variants below min_exp_psnr_db; `report` sees every configuration measured
+tuned_config autotune(
+  const image& gbuffer,
+  const std::function<void(const tuned_config&, double)>& report = {});
+
+}  // namespace filt
\ No newline at end of file
@@ -0,0 +1,369 @@
+#include "uring.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+namespace filt {
+
+static int io_uring_setup(unsigned entries, io_uring_params* params) {
+  return int(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return int(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+io_ring::io_ring(unsigned entries) {
+  io_uring_params params = {};
+  ring_fd = io_uring_setup(entries, &params);
+  if (ring_fd == -1) {
+    log_out("io_uring unavailable ({}), falling back to synchronous io", std::strerror(errno));
+    return;
+  }
+
+  try {
+    sq_entries = params.sq_entries;
+    cq_entries = params.cq_entries;
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+
+    auto map = [&](size_t size, off_t offset) {
+      void* mapped = ::mmap(
+        nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+      if (mapped == MAP_FAILED) {
+        throw errno_error("mmap io_uring");
+      }
+      return static_cast<std::byte*>(mapped);
+    };
+    sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+    cq_ring = single_mmap ? sq_ring : map(cq_ring_size, IORING_OFF_CQ_RING);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = reinterpret_cast<io_uring_sqe*>(map(sqes_size, IORING_OFF_SQES));
+  } catch (const std::system_error& ex) {
+    log_out("{}, falling back to synchronous io", ex.what());
+    release();
+    return;
+  }
+
+  sq_head = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.tail);
+  sq_mask = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.ring_mask);
+  sq_array = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.array);
+  cq_head = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.tail);
+  cq_mask = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<io_uring_cqe*>(cq_ring + params.cq_off.cqes);
+}
+
+io_ring::~io_ring() {
+  release();
+}
+
+void io_ring::release() {
+  if (sqes) {
+    ::munmap(sqes, sqes_size);
+    sqes = nullptr;
+  }
+  if (cq_ring && cq_ring != sq_ring) {
+    ::munmap(cq_ring, cq_ring_size);
+  }
+  cq_ring = nullptr;
+  if (sq_ring) {
+    ::munmap(sq_ring, sq_ring_size);
+    sq_ring = nullptr;
+  }
+  if (ring_fd != -1) {
+    ::close(std::exchange(ring_fd, -1));
+  }
+}
+
+void io_ring::queue(int opcode, int fd, const void* buffer, unsigned size, uint64_t offset, uint64_t tag) {
+  if (!async()) {
+    const ssize_t done = opcode == IORING_OP_READ
+      ? ::pread(fd, const_cast<void*>(buffer), size, off_t(offset))
+      : ::pwrite(fd, buffer, size, off_t(offset));
+    sync_completions.push_back(completion{tag, done == -1 ? -errno : int(done)});
+    ++inflight;
+    return;
+  }
+
+  // more in flight than the completion queue holds would overflow it
+  assert_release(unsigned(inflight) < cq_entries);
+  const unsigned tail = *sq_tail;
+  if (tail - std::atomic_ref(*sq_head).load(std::memory_order_acquire) == sq_entries) {
+    submit();
+  }
+
+  const unsigned index = tail & *sq_mask;
+  io_uring_sqe& sqe = sqes[index];
+  std::memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = uint8_t(opcode);
+  sqe.fd = fd;
+  sqe.addr = reinterpret_cast<uint64_t>(buffer);
+  sqe.len = size;
+  sqe.off = offset;
+  sqe.user_data = tag;
+  sq_array[index] = index;
+  std::atomic_ref(*sq_tail).store(tail + 1, std::memory_order_release);
+  ++unsubmitted;
+  ++inflight;
+}
+
+void io_ring::read(int fd, void* buffer, unsigned size, uint64_t offset, uint64_t tag) {
+  queue(IORING_OP_READ, fd, buffer, size, offset, tag);
+}
+
+void io_ring::write(int fd, const void* buffer, unsigned size, uint64_t offset, uint64_t tag) {
+  queue(IORING_OP_WRITE, fd, buffer, size, offset, tag);
+}
+
+void io_ring::submit() {
+  while (unsubmitted > 0) {
+    const int submitted = io_uring_enter(ring_fd, unsubmitted, 0, 0);
+    if (submitted == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw errno_error("io_uring_enter");
+    }
+    unsubmitted -= submitted;
+  }
+}
+
+io_ring::completion io_ring::wait() {
+  assert_release(inflight > 0);
+  if (!async()) {
+    completion result = sync_completions.front();
+    sync_completions.pop_front();
+    --inflight;
+    return result;
+  }
+
+  submit();
+  while (true) {
+    const unsigned head = *cq_head;
+    if (head != std::atomic_ref(*cq_tail).load(std::memory_order_acquire)) {
+      const io_uring_cqe& cqe = cqes[head & *cq_mask];
+      completion result{cqe.user_data, cqe.res};
+      std::atomic_ref(*cq_head).store(head + 1, std::memory_order_release);
+      --inflight;
+      return result;
+    }
+    if (io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+      throw errno_error("io_uring_enter");
+    }
+  }
+}
+
+// =====================================================================
+
+uring_file_writer::uring_file_writer(const char* filename) {
+  fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    throw errno_error("open output file");
+  }
+}
+
+uring_file_writer::uring_file_writer(int file_fd):
+  fd(file_fd)
+{}
+
+uring_file_writer::~uring_file_writer() {
+  if (fd == -1) {
+    return;
+  }
+  // the kernel may still be reading from the buffers
+  try {
+    while (ring.in_flight() > 0) {
+      reap();
+    }
+  } catch (...) {
+  }
+  ::close(fd);
+}
+
+void uring_file_writer::reap() {
+  auto [tag, result] = ring.wait();
+  buffer& b = buffers[tag];
+  if (result <= 0) {
+    error = error ? error : (result < 0 ? -result : EIO);
+    b.in_flight = false;
+    return;
+  }
+  b.written += result;
+  if (b.written < b.size) {
+    ring.write(fd, b.data.get() + b.written, b.size - b.written, b.file_offset + b.written, tag);
+    ring.submit();
+    return;
+  }
+  b.in_flight = false;
+}
+
+void uring_file_writer::flush_current() {
+  buffer& b = buffers[current];
+  if (b.size == 0) {
+    return;
+  }
+  b.written = 0;
+  b.file_offset = file_size;
+  b.in_flight = true;
+  file_size += b.size;
+  ring.write(fd, b.data.get(), b.size, b.file_offset, current);
+  ring.submit();
+
+  current = (current + 1) % buffer_count;
+  while (buffers[current].in_flight) {
+    reap();
+  }
+  buffers[current].size = 0;
+}
+
+void uring_file_writer::append(const void* data, size_t size) {
+  const char* from = static_cast<const char*>(data);
+  while (size > 0 && error == 0) {
+    buffer& b = buffers[current];
+    const size_t n = std::min<size_t>(size, buffer_size - b.size);
+    std::memcpy(b.data.get() + b.size, from, n);
+    b.size += n;
+    from += n;
+    size -= n;
+    if (b.size == buffer_size) {
+      flush_current();
+    }
+  }
+}
+
+void uring_file_writer::close() {
+  if (error == 0) {
+    flush_current();
+  }
+  while (ring.in_flight() > 0) {
+    reap();
+  }
+  if (::close(std::exchange(fd, -1)) == -1 && error == 0) {
+    error = errno;
+  }
+  if (error) {
+    throw std::system_error(error, std::generic_category(), "write output file");
+  }
+}
+
+// =====================================================================
+
+uring_istream::uring_istream(const char* filename):
+  Imf::IStream(filename)
+{
+  fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    throw fmt_runtime_error("cannot open {}: {}", filename, std::strerror(errno));
+  }
+  struct stat st;
+  if (::fstat(fd, &st) == -1) {
+    ::close(fd);
+    throw errno_error("fstat");
+  }
+  file_size = st.st_size;
+  chunk_count = (file_size + chunk_size - 1) / chunk_size;
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+uring_istream::~uring_istream() {
+  try {
+    while (ring.in_flight() > 0) {
+      ring.wait();
+    }
+  } catch (...) {
+  }
+  ::close(fd);
+}
+
+unsigned uring_istream::chunk_bytes(int64_t chunk) const {
+  return unsigned(std::min<uint64_t>(chunk_size, file_size - chunk * chunk_size));
+}
+
+void uring_istream::request(int64_t chunk) {
+  slot& s = slot_of(chunk);
+  if (s.chunk == chunk) {
+    return;
+  }
+  // the kernel is still writing the chunk this slot held
+  while (s.in_flight) {
+    reap();
+  }
+  if (!s.data) {
+    s.data = std::make_unique_for_overwrite<char[]>(chunk_size);
+  }
+  s.chunk = chunk;
+  s.filled = 0;
+  s.in_flight = true;
+  ring.read(fd, s.data.get(), chunk_bytes(chunk), chunk * chunk_size, chunk);
+}
+
+void uring_istream::reap() {
+  auto [chunk, result] = ring.wait();
+  if (result < 0) {
+    throw fmt_runtime_error("cannot read {}: {}", fileName(), std::strerror(-result));
+  }
+  if (result == 0) {
+    throw fmt_runtime_error("{} was truncated while reading", fileName());
+  }
+  slot& s = slot_of(chunk);
+  s.filled += result;
+  if (s.filled < chunk_bytes(chunk)) {
+    const uint64_t at = chunk * chunk_size + s.filled;
+    ring.read(fd, s.data.get() + s.filled, chunk_bytes(chunk) - s.filled, at, chunk);
+    return;
+  }
+  s.in_flight = false;
+}
+
+const char* uring_istream::chunk_data(int64_t chunk) {
+  if (chunk > furthest_chunk) {
+    if (furthest_chunk >= 0 && chunk == furthest_chunk + 1) {
+      read_ahead = std::clamp(2 * read_ahead, 1, max_read_ahead);
+    }
+    furthest_chunk = chunk;
+  }
+
+  const int64_t window_end = std::min<int64_t>(chunk + 1 + read_ahead, chunk_count);
+  for (int64_t c = chunk; c < window_end; ++c) {
+    request(c);
+  }
+  ring.submit();
+  slot& s = slot_of(chunk);
+  while (s.in_flight) {
+    reap();
+  }
+  return s.data.get();
+}
+
+bool uring_istream::read(char c[], int n) {
+  if (n < 0 || position + n > file_size) {
+    throw fmt_runtime_error("Early end of file {}", fileName());
+  }
+  while (n > 0) {
+    const int64_t chunk = position / chunk_size;
+    const uint64_t offset = position % chunk_size;
+    const int count = int(std::min<uint64_t>(n, chunk_size - offset));
+    std::memcpy(c, chunk_data(chunk) + offset, count);
+    c += count;
+    n -= count;
+    position += count;
+  }
+  return position < file_size;
+}
+
+}  // namespace filt
\ No newline at end of file
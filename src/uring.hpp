@@ -0,0 +1,158 @@
+#pragma once
+#include "util.hpp"
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <ImfIO.h>
+#include <linux/io_uring.h>
+#include <memory>
+
+namespace filt {
+
+// minimal io_uring over the raw syscalls, falling back to pread/pwrite where the kernel refuses it;
+// not thread-safe
+class io_ring: nonmovable {
+  int ring_fd = -1;
+  unsigned sq_entries = 0;
+  unsigned cq_entries = 0;
+  std::byte* sq_ring = nullptr;
+  size_t sq_ring_size = 0;
+  std::byte* cq_ring = nullptr;
+  size_t cq_ring_size = 0;
+  io_uring_sqe* sqes = nullptr;
+  size_t sqes_size = 0;
+  unsigned* sq_head = nullptr;
+  unsigned* sq_tail = nullptr;
+  unsigned* sq_mask = nullptr;
+  unsigned* sq_array = nullptr;
+  unsigned* cq_head = nullptr;
+  unsigned* cq_tail = nullptr;
+  unsigned* cq_mask = nullptr;
+  io_uring_cqe* cqes = nullptr;
+  unsigned unsubmitted = 0;
+  int inflight = 0;
+
+public:
+  struct completion {
+    uint64_t tag;
+    // bytes transferred, or -errno
+    int result;
+  };
+
+private:
+  std::deque<completion> sync_completions;
+
+  void release();
+  void queue(int opcode, int fd, const void* buffer, unsigned size, uint64_t offset, uint64_t tag);
+
+public:
+  explicit io_ring(unsigned entries = 64);
+  ~io_ring();
+
+  bool async() const {
+    return ring_fd != -1;
+  }
+
+  int in_flight() const {
+    return inflight;
+  }
+
+  // `tag` comes back with the completion; submits by itself when the submission queue is full
+  void read(int fd, void* buffer, unsigned size, uint64_t offset, uint64_t tag);
+  void write(int fd, const void* buffer, unsigned size, uint64_t offset, uint64_t tag);
+
+  // hands every queued operation to the kernel
+  void submit();
+
+  // the next finished operation, after submitting the queued ones; waits if none has finished
+  completion wait();
+};
+
+// sequential file output, each full buffer written through io_ring while the next one fills
+class uring_file_writer: nonmovable {
+  static constexpr unsigned buffer_size = 1 << 20;
+  static constexpr int buffer_count = 4;
+
+  struct buffer {
+    std::unique_ptr<char[]> data = std::make_unique_for_overwrite<char[]>(buffer_size);
+    unsigned size = 0;
+    unsigned written = 0;
+    uint64_t file_offset = 0;
+    bool in_flight = false;
+  };
+
+  int fd = -1;
+  io_ring ring{buffer_count};
+  std::array<buffer, buffer_count> buffers;
+  int current = 0;
+  uint64_t file_size = 0;
+  int error = 0;
+
+  void reap();
+  void flush_current();
+
+public:
+  explicit uring_file_writer(const char* filename);
+  // takes over `file_fd`, a regular file open for writing and empty
+  explicit uring_file_writer(int file_fd);
+  ~uring_file_writer();
+
+  // never fails by itself: an error is kept and reported by close()
+  void append(const void* data, size_t size);
+
+  // writes out what is buffered, waits for every write and closes the file; throws the first error
+  void close();
+};
+
+// Imf::IStream reading 1 MiB chunks through io_ring with a read-ahead window that doubles up to
+// max_read_ahead; read() copies, as chunks share a ring of slot_count buffers
+class uring_istream: public Imf::IStream {
+  static constexpr int64_t chunk_size = 1 << 20;
+  static constexpr int max_read_ahead = 16;
+  // the chunk being read and its whole read-ahead window
+  static constexpr int slot_count = max_read_ahead + 1;
+
+  // chunk c lives in slots[c % slot_count]
+  struct slot {
+    std::unique_ptr<char[]> data;
+    int64_t chunk = -1;
+    unsigned filled = 0;
+    bool in_flight = false;
+  };
+
+  int fd = -1;
+  uint64_t file_size = 0;
+  int64_t chunk_count = 0;
+  uint64_t position = 0;
+  std::array<slot, slot_count> slots;
+  int64_t furthest_chunk = -1;
+  int read_ahead = 0;
+  io_ring ring;
+
+  unsigned chunk_bytes(int64_t chunk) const;
+  slot& slot_of(int64_t chunk) {
+    return slots[chunk % slot_count];
+  }
+  void request(int64_t chunk);
+  void reap();
+  // waits until `chunk` is in its slot, with the read-ahead window after it requested
+  const char* chunk_data(int64_t chunk);
+
+public:
+  explicit uring_istream(const char* filename);
+  ~uring_istream() override;
+
+  bool read(char c[], int n) override;
+
+  uint64_t tellg() override {
+    return position;
+  }
+
+  void seekg(uint64_t pos) override {
+    position = pos;
+  }
+
+  void clear() override {}
+};
+
+}  // namespace filt
\ No newline at end of file
@@ -1,13 +1,35 @@
 #include "util.hpp"
+#include <algorithm>
+#include <numeric>
 #include <sched.h>
 
 void set_affinity(int from, int upto) {
+  std::vector<int> cpus(std::max(0, upto - from));
+  std::iota(cpus.begin(), cpus.end(), from);
+  set_affinity(cpus);
+}
+
+void set_affinity(std::span<const int> cpus) {
   cpu_set_t cpuset;
   CPU_ZERO(&cpuset);
-  for (int cpu = from; cpu < upto; ++cpu) {
+  for (int cpu: cpus) {
     CPU_SET(cpu, &cpuset);
   }
   if (sched_setaffinity(gettid(), sizeof(cpuset), &cpuset) == -1) {
     throw errno_error("setaffinity");
   }
+}
+
+std::vector<int> get_affinity() {
+  cpu_set_t cpuset;
+  if (sched_getaffinity(gettid(), sizeof(cpuset), &cpuset) == -1) {
+    throw errno_error("getaffinity");
+  }
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &cpuset)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
 }
\ No newline at end of file
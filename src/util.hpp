@@ -4,12 +4,16 @@
 #include <fmt/format.h>
 #include <random>
 #include <sched.h>
+#include <span>
 #include <stdexcept>
 #include <system_error>
 #include <unistd.h>
 #include <fstream>
+#include <vector>
 
 void set_affinity(int from, int upto);
+void set_affinity(std::span<const int> cpus);
+std::vector<int> get_affinity();
 
 template<typename... Args>
 auto fmt_runtime_error(fmt::format_string<Args...> format, Args&&... args) {